@@ -1,24 +1,35 @@
 #ifndef MOUSYGEM__CLIENT_HPP
 #define MOUSYGEM__CLIENT_HPP
 
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <vector>
 #include <string>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 
 namespace Mousygem {
     class Server;
+    class EpollEngine;
+    class ClientPool;
     
     struct Socket;
     struct SocketAddress;
+    struct AcceptorShard;
+    struct RateLimitEntry;
+    struct VirtualHost;
     
     /**
      * Client information
      */
     class Client {
         friend class Server;
-        
+        friend class EpollEngine;
+        friend class ClientPool;
+    
     public:
         /**
          * Get the IP address of the client in string format
@@ -27,20 +38,89 @@ namespace Mousygem {
         std::string ip_address() const;
         
         /**
-         * Get the DER-encoded certificate received from the client if one was received
-         * @return certificate
+         * SHA-256 fingerprint of a certificate
+         */
+        using CertificateFingerprint = std::array<std::byte, 32>;
+        
+        /**
+         * Get the SHA-256 fingerprint of the certificate received from the client if one was received. This identifies the client (e.g. for
+         * trust on first use) without hashing the certificate again. It's computed once per TLS session, so resumed sessions get it for free.
+         * @return fingerprint
          */
-        const std::optional<std::vector<std::byte>> &get_certificate() const noexcept {
-            return this->certificate;
+        const std::optional<CertificateFingerprint> &get_certificate_fingerprint() const noexcept {
+            return this->certificate_fingerprint;
         }
         
-        ~Client();
+        /**
+         * Get the DER-encoded certificate received from the client if one was received. It's encoded the first time this is called, so
+         * prefer get_certificate_fingerprint() if that's all you need. This function is thread-safe.
+         * @return certificate, or nullopt if none was received (or, rarely, if it couldn't be encoded, such as when out of memory)
+         */
+        const std::optional<std::vector<std::byte>> &get_certificate() const noexcept;
+        
+        /**
+         * Get the hostname the client asked for in the TLS handshake (SNI)
+         * @return hostname, or an empty string if the client didn't send one
+         */
+        const std::string &get_server_name() const noexcept {
+            return this->server_name;
+        }
+        
+        /**
+         * Get memory that lasts until the client disconnects, such as for building a response with std::pmr containers. Allocating from it
+         * is cheap and usually doesn't touch the heap, but nothing is given back until the client disconnects, so it's meant for the memory a
+         * single request needs. This is not thread-safe, so only use it from one thread at a time while handling the request.
+         * @return memory resource
+         */
+        std::pmr::memory_resource *get_memory_resource() const noexcept {
+            return &this->memory;
+        }
         
+        ~Client();
+    
     private:
         std::unique_ptr<SocketAddress> socket_address;
         std::unique_ptr<Socket> socket;
         
-        std::optional<std::vector<std::byte>> certificate;
+        /** Certificate received from the client (an X509 we hold a reference to), or nullptr */
+        void *peer_certificate = nullptr;
+        
+        std::optional<CertificateFingerprint> certificate_fingerprint;
+        
+        /** DER encoding of the certificate, made on demand */
+        mutable std::optional<std::vector<std::byte>> certificate;
+        mutable std::mutex certificate_mutex;
+        
+        /** Shard the client was accepted from */
+        AcceptorShard *shard = nullptr;
+        
+        /** When the client was accepted */
+        std::chrono::steady_clock::time_point accepted_at;
+        
+        /** Rate limiting entry for the client's address (nullptr if not tracked) */
+        RateLimitEntry *rate_limit_entry = nullptr;
+        
+        /** Did the client's address already have as many connections as it's allowed? */
+        bool over_connection_limit = false;
+        
+        /** Hostname sent with SNI */
+        std::string server_name;
+        
+        /** Virtual host the request is for (nullptr if none) */
+        const VirtualHost *virtual_host = nullptr;
+        
+        /** Connected clients, linked so the server can reach them without allocating */
+        Client *previous_connected = nullptr;
+        Client *next_connected = nullptr;
+        
+        /** Buffer for memory, kept when the client is reused for another connection */
+        std::array<std::byte, 2048> memory_buffer;
+        
+        /** Memory for the request (the URI, and anything the handler wants), freed all at once when the client disconnects */
+        mutable std::pmr::monotonic_buffer_resource memory;
+        
+        /** Clear everything from the last connection so the client can be reused */
+        void reset() noexcept;
         
         Client();
     };
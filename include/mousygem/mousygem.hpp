@@ -3,7 +3,10 @@
 
 #include "client.hpp"
 #include "response.hpp"
+#include "router.hpp"
 #include "server.hpp"
+#include "static_files.hpp"
+#include "statistics.hpp"
 #include "uri.hpp"
 
 #endif
@@ -8,15 +8,127 @@
 #include <fstream>
 #include <variant>
 #include <optional>
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 
 namespace Mousygem {
     class Server;
+    class ResponseWriter;
+    
+    /**
+     * A file opened for sending as response data.
+     * 
+     * Unlike std::ifstream, the server can send this straight from the page cache with kernel TLS (SSL_sendfile) when the kernel supports it.
+     */
+    class ResponseFile {
+    public:
+        /**
+         * Open a file
+         * @param path path to the file
+         * @throws std::runtime_error if the file could not be opened
+         */
+        explicit ResponseFile(const std::filesystem::path &path);
+        
+        /**
+         * Get the file descriptor
+         * @return file descriptor
+         */
+        int get_handle() const noexcept {
+            return this->handle;
+        }
+        
+        /**
+         * Get the size of the file when it was opened
+         * @return size in bytes
+         */
+        std::uint64_t get_size() const noexcept {
+            return this->size;
+        }
+        
+        ResponseFile(ResponseFile &&other) noexcept;
+        ResponseFile &operator =(ResponseFile &&other) noexcept;
+        ResponseFile(const ResponseFile &) = delete;
+        ResponseFile &operator =(const ResponseFile &) = delete;
+        ~ResponseFile() noexcept;
+        
+    private:
+        int handle = -1;
+        std::uint64_t size = 0;
+    };
+    
+    /**
+     * A read-only memory mapping of a file (or part of one) for sending as response data.
+     * 
+     * Share one MappedFile between responses with std::shared_ptr so that every client fetching the file is sent the same pages of the page
+     * cache, rather than each response holding its own copy on the heap. The mapping is hinted for sequential access.
+     * 
+     * The file should not be truncated while it is mapped, as reading past the new end of the file raises SIGBUS.
+     */
+    class MappedFile {
+    public:
+        /**
+         * Map a file
+         * @param path   path to the file
+         * @param offset offset in the file to start at
+         * @param length number of bytes to map, or SIZE_MAX for the rest of the file
+         * @throws std::runtime_error if the file could not be opened or mapped, or if the region is out of range
+         */
+        explicit MappedFile(const std::filesystem::path &path, std::uint64_t offset = 0, std::size_t length = SIZE_MAX);
+        
+        /**
+         * Get the mapped data
+         * @return pointer to the data (nullptr if empty)
+         */
+        const std::byte *data() const noexcept {
+            return this->region;
+        }
+        
+        /**
+         * Get the size of the mapped data
+         * @return size in bytes
+         */
+        std::size_t size() const noexcept {
+            return this->region_size;
+        }
+        
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator =(const MappedFile &) = delete;
+        ~MappedFile() noexcept;
+        
+    private:
+        /** Start of the mapping (page aligned) */
+        void *mapping = nullptr;
+        std::size_t mapping_size = 0;
+        
+        /** Requested region within the mapping */
+        const std::byte *region = nullptr;
+        std::size_t region_size = 0;
+    };
+    
+    /**
+     * Generates response data on demand.
+     * 
+     * The server calls this with a buffer whenever it is ready to send more data, so large responses can be generated without holding the
+     * whole thing in memory, and the client gets the first bytes as soon as they are made. Return the number of bytes written to the buffer
+     * (at most size), or 0 when there is no more data. Throwing an exception aborts the response and disconnects the client
+     * without a TLS close_notify, so the client can tell the response is incomplete.
+     * 
+     * This may be called from any thread, but never from more than one thread at a time for the same response. With the epoll connection
+     * engine, it is called from an event loop, so it should not block for long.
+     */
+    using ResponseSource = std::function<std::size_t (std::byte *buffer, std::size_t size)>;
     
     /**
      * Response class
      */
     class Response {
         friend class Server;
+        friend class ResponseWriter;
+        friend class ResponseCache;
     public:
         /**
          * Input codes
@@ -77,6 +189,20 @@ namespace Mousygem {
             CertificateNotValid = 62
         };
         
+        /**
+         * What identifies a cached response
+         */
+        enum class CacheKey {
+            /** Hostname and path; the same response is sent regardless of input */
+            Path,
+            
+            /** Hostname, path, and input */
+            PathAndInput,
+            
+            /** Hostname, path, input, and the client's certificate */
+            PathInputAndCertificate
+        };
+        
         /**
          * Construct a response without data.
          * @param code response code to send
@@ -112,6 +238,34 @@ namespace Mousygem {
         Response(ResponseCode code, const std::string &meta, std::vector<std::byte> &&data) :
             code(code), meta(meta), data(std::move(data)) {}
         
+        /**
+         * Construct a response, moving a byte vector of data from a memory resource (such as Client::get_memory_resource()) to prevent
+         * copying. The resource must outlive the response. This should only be used with response 2X codes.
+         * @param code response code to send
+         * @param meta meta to send
+         * @param data data to send after the response
+         */
+        Response(ResponseCode code, const std::string &meta, std::pmr::vector<std::byte> &&data) :
+            code(code), meta(meta), data(std::move(data)) {}
+        
+        /**
+         * Construct a response with shared data. The data is not copied, so this is useful for sending the same data to many clients. This should only be used with response 2X codes.
+         * @param code response code to send
+         * @param meta meta to send
+         * @param data data to send after the response (must not be modified while being sent)
+         */
+        Response(ResponseCode code, const std::string &meta, std::shared_ptr<const std::vector<std::byte>> data) :
+            code(code), meta(meta), data(std::move(data)) {}
+        
+        /**
+         * Construct a response with a mapped file. This should only be used with response 2X codes.
+         * @param code response code to send
+         * @param meta meta to send
+         * @param data mapped file to send
+         */
+        Response(ResponseCode code, const std::string &meta, std::shared_ptr<const MappedFile> data) :
+            code(code), meta(meta), data(std::move(data)) {}
+        
         /**
          * Construct a response, using a file stream. This should only be used with response 2X codes.
          * @param code response code to send
@@ -121,6 +275,24 @@ namespace Mousygem {
         Response(ResponseCode code, const std::string &meta, std::ifstream &&data) :
             code(code), meta(meta), data(std::move(data)) {}
         
+        /**
+         * Construct a response, using an open file. This should only be used with response 2X codes.
+         * @param code response code to send
+         * @param meta meta to send
+         * @param data file to send
+         */
+        Response(ResponseCode code, const std::string &meta, ResponseFile &&data) :
+            code(code), meta(meta), data(std::move(data)) {}
+        
+        /**
+         * Construct a response, generating the data as it is sent. This should only be used with response 2X codes.
+         * @param code response code to send
+         * @param meta meta to send
+         * @param data data source
+         */
+        Response(ResponseCode code, const std::string &meta, ResponseSource &&data) :
+            code(code), meta(meta), data(std::move(data)) {}
+        
         /**
          * Set the response code
          * @param code response code to send
@@ -169,6 +341,30 @@ namespace Mousygem {
             this->data = std::move(data);
         }
         
+        /**
+         * Set the data, moving a byte vector of data from a memory resource to prevent copying. The resource must outlive the response. This should only be used with response 2X codes.
+         * @param data data to send
+         */
+        void set_data(std::pmr::vector<std::byte> &&data) {
+            this->data = std::move(data);
+        }
+        
+        /**
+         * Set the data to shared data. This should only be used with response 2X codes.
+         * @param data data to send (must not be modified while being sent)
+         */
+        void set_data(std::shared_ptr<const std::vector<std::byte>> data) {
+            this->data = std::move(data);
+        }
+        
+        /**
+         * Set the data to a mapped file. This should only be used with response 2X codes.
+         * @param data mapped file to send
+         */
+        void set_data(std::shared_ptr<const MappedFile> data) {
+            this->data = std::move(data);
+        }
+        
         /**
          * Set the data to a file stream. This should only be used with response 2X codes.
          * @param data data to send
@@ -177,6 +373,22 @@ namespace Mousygem {
             this->data = std::move(data);
         }
         
+        /**
+         * Set the data to an open file. This should only be used with response 2X codes.
+         * @param data data to send
+         */
+        void set_data(ResponseFile &&data) {
+            this->data = std::move(data);
+        }
+        
+        /**
+         * Set the data to a data source. This should only be used with response 2X codes.
+         * @param data data source
+         */
+        void set_data(ResponseSource &&data) {
+            this->data = std::move(data);
+        }
+        
         /**
          * Clear the data
          */
@@ -192,6 +404,39 @@ namespace Mousygem {
             return data.has_value();
         }
         
+        /**
+         * Let the server reuse this response for later requests with the same key for a while, without calling respond() again.
+         * 
+         * Only responses without data or with in-memory data (including shared data and mapped files) can be cached; others are sent but not
+         * cached.
+         * 
+         * Every cached response for a path must use the same key. If a handler gives responses for the same path different keys (such as a
+         * per-certificate page for some clients and an anonymous page for the rest), the path stops being cached until the responses already
+         * cached for it expire.
+         * @param ttl how long to reuse the response for (0 to not cache it, which is the default)
+         * @param key what requests must have in common to share the response
+         */
+        void set_cache_ttl(std::chrono::milliseconds ttl, CacheKey key = CacheKey::PathAndInput) noexcept {
+            this->cache_ttl = ttl;
+            this->cache_key = key;
+        }
+        
+        /**
+         * Get how long the server may reuse this response for
+         * @return TTL (0 if not cached)
+         */
+        std::chrono::milliseconds get_cache_ttl() const noexcept {
+            return this->cache_ttl;
+        }
+        
+        /**
+         * Get what requests must have in common to share this response if cached
+         * @return cache key
+         */
+        CacheKey get_cache_key() const noexcept {
+            return this->cache_key;
+        }
+        
     private:
         /** Response code */
         ResponseCode code;
@@ -199,8 +444,15 @@ namespace Mousygem {
         /** Meta */
         std::string meta;
         
+        /** How long this can be cached for */
+        std::chrono::milliseconds cache_ttl = std::chrono::milliseconds(0);
+        CacheKey cache_key = CacheKey::PathAndInput;
+        
+        /** Already-formatted "NN meta\r\n" header, if this came from the cache */
+        std::shared_ptr<const std::string> formatted_header;
+        
         /** Data we're sending */
-        std::optional<std::variant<std::vector<std::byte>, std::ifstream>> data;
+        std::optional<std::variant<std::vector<std::byte>, std::pmr::vector<std::byte>, std::shared_ptr<const std::vector<std::byte>>, std::shared_ptr<const MappedFile>, std::ifstream, ResponseFile, ResponseSource>> data;
     };
 }
 
@@ -0,0 +1,161 @@
+#ifndef MOUSYGEM__ROUTER_HPP
+#define MOUSYGEM__ROUTER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "response.hpp"
+#include "statistics.hpp"
+
+namespace Mousygem {
+    class URI;
+    class Client;
+    
+    /**
+     * Dispatches requests to handlers by path.
+     *
+     * Routes are patterns made of path segments, where each segment is either matched exactly, or written as {name} to match any
+     * (non-empty) segment and capture it. A pattern whose last segment is "*" matches anything below it. For example:
+     * - "/about" matches only "/about"
+     * - "/users/{id}/posts" matches "/users/42/posts", capturing "42" as "id"
+     * - "/files" followed by a "*" segment matches "/files/" and everything under it
+     *
+     * Routes are compiled into a tree of path segments as they're added, so finding one costs one step per segment no matter how many
+     * routes there are. If more than one route matches, exact segments win over {name} segments, which win over a trailing "*" segment. Paths are matched as
+     * sent by the client (i.e. still percent-encoded), and matching never allocates.
+     *
+     * Call respond() from your Server's respond() to dispatch a request.
+     */
+    class Router {
+    public:
+        /** Maximum number of {name} segments in a route */
+        static const constexpr std::size_t MAX_PARAMETERS = 8;
+        
+        /**
+         * Segments captured by a route. These point into the URI's path, so they're only valid as long as it is.
+         */
+        class Parameters {
+            friend class Router;
+        public:
+            /**
+             * Get a captured segment by name
+             * @param name name given in the route's pattern
+             * @return segment (still percent-encoded), or nullopt if the route has no parameter with that name
+             */
+            std::optional<std::string_view> get(std::string_view name) const noexcept;
+            
+            /**
+             * Get a captured segment by position
+             * @param index index of the parameter in the route's pattern
+             * @return segment (still percent-encoded)
+             */
+            std::string_view operator[](std::size_t index) const noexcept {
+                return this->values[index];
+            }
+            
+            /**
+             * Get the number of captured segments
+             * @return number of segments
+             */
+            std::size_t size() const noexcept {
+                return this->count;
+            }
+            
+            /**
+             * Get the part of the path matched by a trailing "*" segment (without the leading slash)
+             * @return rest of the path (still percent-encoded), or an empty string if the route didn't end with a "*" segment
+             */
+            std::string_view get_rest() const noexcept {
+                return this->rest;
+            }
+        
+        private:
+            std::array<std::string_view, MAX_PARAMETERS> values;
+            std::size_t count = 0;
+            std::string_view rest;
+            const std::vector<std::string> *names = nullptr;
+        };
+        
+        /**
+         * Handler for a route
+         */
+        using Handler = std::function<Response (const URI &uri, const Client &client, const Parameters &parameters)>;
+        
+        /**
+         * Add a route. This is not thread-safe, so add all routes before serving any requests.
+         * @param pattern pattern to match (see above)
+         * @param handler handler to call for matching requests
+         * @throws std::invalid_argument if the pattern is invalid or already added
+         */
+        void add(std::string_view pattern, Handler handler);
+        
+        /**
+         * Find the route for a path without calling it or counting it. This function is thread-safe.
+         * @param path       path as sent by the client (e.g. URI::raw_path())
+         * @param parameters set to the segments captured by the route
+         * @return handler, or nullptr if no route matches
+         */
+        const Handler *find(std::string_view path, Parameters &parameters) const noexcept;
+        
+        /**
+         * Respond to a request with the matching route's handler. This function is thread-safe.
+         * @param uri    URI requested
+         * @param client client requesting it
+         * @return response from the handler, or a 51 (not found) response if no route matches
+         */
+        Response respond(const URI &uri, const Client &client) const;
+        
+        /**
+         * Get the number of requests each route handled. This function is thread-safe.
+         * @return statistics
+         */
+        RouterStatistics get_statistics() const;
+        
+        Router() = default;
+        Router(const Router &) = delete;
+        Router &operator =(const Router &) = delete;
+    
+    private:
+        struct Route {
+            std::string pattern;
+            Handler handler;
+            std::vector<std::string> parameter_names;
+            mutable std::atomic<std::uint64_t> hits = 0;
+        };
+        
+        struct Node {
+            /** Children for exact segments, sorted by segment */
+            std::vector<std::pair<std::string, std::unique_ptr<Node>>> children;
+            
+            /** Child for {name} segments */
+            std::unique_ptr<Node> parameter_child;
+            
+            /** Route ending here */
+            const Route *route = nullptr;
+            
+            /** Route ending here with a "*" segment */
+            const Route *rest_route = nullptr;
+        };
+        
+        std::vector<std::unique_ptr<Route>> routes;
+        Node root;
+        mutable std::atomic<std::uint64_t> unmatched = 0;
+        
+        /** Find the route for a path */
+        const Route *find_route(std::string_view path, Parameters &parameters) const noexcept;
+        
+        /** Find the route for the rest of a path, starting at a node */
+        static const Route *match(const Node &node, std::string_view path, Parameters &parameters) noexcept;
+    };
+}
+
+#endif
@@ -5,6 +5,16 @@
 #include <cstdint>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "statistics.hpp"
 
 namespace Mousygem {
     class URI;
@@ -13,17 +23,28 @@ namespace Mousygem {
     
     struct Socket;
     struct SocketAddress;
+    struct AcceptorShard;
     
     class SSLContext;
+    class EpollEngine;
+    class WorkerPool;
+    class ResponseWriter;
+    class ResponseCache;
+    class TimerThread;
+    class RateLimiter;
+    struct ServerMetrics;
+    struct VirtualHost;
     
     /**
      * Server instance.
-     * 
+     *
      * Remarks:
      * - This class does manage its own OpenSSL context, but it does NOT handle initializing OpenSSL.
      * - OpenSSL needs to be initialized before creating a server. You can use the OpenSSL_add_ssl_algorithms() macro in <openssl/ssl.h> (or SSL_library_init() with the equivalent functions for setting up SSL) to do this.
      */
     class Server {
+        friend class EpollEngine;
+    
     public:
         /**
          * Default port
@@ -31,41 +52,360 @@ namespace Mousygem {
         static const constexpr std::uint16_t DEFAULT_GEMINI_PORT = 1965;
         
         /**
-         * Set the TLS certificate file (PEM format)
+         * Callback for finishing a request passed to respond_async(). It must be called exactly once, and it can be called from any thread.
+         */
+        using ResponseCallback = std::function<void (Response response)>;
+        
+        /**
+         * Handler for requests to a virtual host added with add_virtual_host(). It's called in place of respond_async() from the same threads, so the same rules apply.
+         */
+        using VirtualHostHandler = std::function<Response (const URI &url, const Client &client)>;
+        
+        /**
+         * Method used for serving connected clients
+         */
+        enum class ConnectionEngine {
+            /** Serve each client on its own thread using blocking sockets (default) */
+            Threaded,
+            
+            /** Serve clients using non-blocking sockets on a small number of epoll event loop threads */
+            Epoll
+        };
+        
+        /**
+         * Set the connection engine. This must not be called while accepting clients.
+         *
+         * When using ConnectionEngine::Epoll, respond() is called on the event loop threads, so it should not block for long. Override respond_async() instead to wait on something without blocking the loop.
+         *
+         * @param engine       engine to use
+         * @param loop_threads number of event loop threads for ConnectionEngine::Epoll; if 0, use one per hardware thread
+         */
+        void set_connection_engine(ConnectionEngine engine, unsigned int loop_threads = 0);
+        
+        /**
+         * What to do with a newly accepted client when the worker pool's queue is full
+         */
+        enum class Backpressure {
+            /** Stop accepting clients until a worker frees up room in the queue (default) */
+            Block,
+            
+            /** Disconnect the client immediately */
+            Reject
+        };
+        
+        /**
+         * Configure the worker pool used by ConnectionEngine::Threaded. The workers are started by accept_clients() and persist until the server is destroyed. This must not be called while accepting clients.
+         *
+         * @param threads        number of worker threads; if 0, use the maximum_parallel_connections passed to accept_clients()
+         * @param queue_capacity number of accepted clients that can wait for a worker; if 0, use the number of worker threads
+         * @param backpressure   what to do when the queue is full
+         */
+        void set_worker_pool(std::size_t threads, std::size_t queue_capacity = 0, Backpressure backpressure = Backpressure::Block);
+        
+        /**
+         * Get statistics for the worker pool, such as its queue depth and how long clients waited for a worker. This function is thread-safe.
+         * @return statistics (all zero if the worker pool has not been started)
+         */
+        WorkerPoolStatistics get_worker_pool_statistics() const;
+        
+        /**
+         * Options for the listening socket(s)
+         */
+        struct ListenOptions {
+            /** Maximum number of connections waiting to be accepted (capped by the kernel, e.g. net.core.somaxconn on Linux) */
+            int backlog = 4096;
+            
+            /** If nonzero, don't wake up the acceptor until the client sends data or this many seconds pass (TCP_DEFER_ACCEPT) */
+            std::chrono::seconds defer_accept = std::chrono::seconds(0);
+            
+            /** If nonzero, enable TCP Fast Open with this many pending requests allowed (TCP_FASTOPEN) */
+            int fast_open_queue_length = 0;
+        };
+        
+        /**
+         * Set options for the listening socket(s). This must not be called while accepting clients.
+         * @param options options to use
+         */
+        void set_listen_options(const ListenOptions &options);
+        
+        /**
+         * Split accepting clients across multiple listening sockets bound to the same address with SO_REUSEPORT, each with its own acceptor thread, so the kernel balances new connections between them. This must not be called while accepting clients.
+         *
+         * With ConnectionEngine::Epoll, each shard gets its own event loop, and shard_count overrides the loop thread count.
+         *
+         * @param shard_count number of listening sockets/acceptor threads; if 0, use one per hardware thread; if 1, SO_REUSEPORT is not used
+         * @param pin_to_cpus pin each acceptor thread to its own CPU
+         */
+        void set_acceptor_shards(unsigned int shard_count, bool pin_to_cpus = false);
+        
+        /**
+         * Serve on listening sockets that are already bound instead of binding new ones, such as ones inherited from another process. The server takes ownership of them, and each one gets its own acceptor shard (overriding set_acceptor_shards()). They're used by the next call to accept_clients() and closed when it returns. This must not be called while accepting clients.
+         * @param sockets listening socket file descriptors
+         * @throws std::invalid_argument if any of them isn't a listening stream socket (none are taken in that case)
+         */
+        void use_listening_sockets(const std::vector<int> &sockets);
+        
+        /**
+         * Serve on listening sockets passed down by the parent process with the LISTEN_FDS and LISTEN_PID environment variables (as systemd socket activation does), if there are any. The variables are then unset so child processes don't take them too. This must not be called while accepting clients.
+         * @return true if any sockets were passed down
+         * @throws std::invalid_argument if any of them isn't a listening stream socket
+         */
+        bool use_inherited_listening_sockets();
+        
+        /**
+         * Take over the listening sockets of a server in another process that's waiting in hand_off_listening_sockets(), such as an older version of this one. The sockets are never closed in between, so clients connecting during a restart are never refused. This must not be called while accepting clients.
+         * @param path path of the Unix socket given to hand_off_listening_sockets()
+         * @throws std::runtime_error if the sockets could not be received
+         */
+        void receive_listening_sockets(const std::filesystem::path &path);
+        
+        /**
+         * Wait for a server in another process to take over the listening sockets with receive_listening_sockets(). Once it has them, call shutdown() to stop accepting clients and drain the ones still connected; new clients go to the other server in the meantime. This must be called while accepting clients, and it is thread-safe.
+         * @param path    path to make a Unix socket at (replaced if it already exists, and removed when done)
+         * @param timeout how long to wait for the other server
+         * @return true if the other server took the sockets, false if it didn't in time (or the server stopped accepting clients)
+         * @throws std::invalid_argument if the path is too long for a Unix socket
+         * @throws std::runtime_error    if the Unix socket could not be made or the sockets could not be sent
+         */
+        bool hand_off_listening_sockets(const std::filesystem::path &path, std::chrono::milliseconds timeout);
+        
+        /**
+         * Get connection accounting for each acceptor shard from the last (or current) call to accept_clients(). This function is thread-safe.
+         * @return statistics for each shard
+         */
+        std::vector<AcceptorShardStatistics> get_acceptor_shard_statistics() const;
+        
+        /**
+         * Set the TLS certificate file (PEM format). This must not be called while accepting clients (use reload_certificate() instead).
          * @param path path to the file
          */
         void use_certificate_file(const std::filesystem::path &path);
         
         /**
-         * Set the TLS private key file (PEM format)
+         * Set the TLS private key file (PEM format). This must not be called while accepting clients (use reload_certificate() instead).
          * @param path path to the file
          */
         void use_private_key_file(const std::filesystem::path &path);
         
+        /**
+         * Replace the TLS certificate and private key without dropping anyone, such as after renewing the certificate. This can be called while accepting clients, and it's thread-safe.
+         *
+         * A new TLS context is built with the same settings and swapped in for new connections, while connections already made keep using the old one until they finish. Session ticket keys are kept, so clients can still resume sessions with their tickets, but sessions in the session cache can't be resumed after a reload.
+         *
+         * @param certificate path to the certificate (chain) file (PEM format)
+         * @param private_key path to the private key file for the certificate (PEM format)
+         * @throws std::runtime_error if the certificate or private key could not be loaded (the current ones are kept)
+         */
+        void reload_certificate(const std::filesystem::path &certificate, const std::filesystem::path &private_key);
+        
+        /**
+         * Serve another hostname (a capsule) from this server with its own certificate.
+         *
+         * The certificate is picked during the handshake by the hostname the client sends with SNI; clients that send none, or a hostname
+         * that wasn't added, get the certificate set with use_certificate_file(). Once any virtual host is added, requests for a different
+         * hostname than the one sent with SNI are refused with a 53 response, and requests for a virtual host's hostname go to its handler.
+         * Requests for any other hostname (and for virtual hosts without a handler) still go to respond_async(). Hostnames are matched
+         * case-insensitively. All virtual hosts share the server's engine, threads, session cache, and response cache.
+         *
+         * This must not be called while accepting clients.
+         *
+         * @param hostname    hostname to serve (e.g. "example.org")
+         * @param certificate path to the certificate (chain) file for the hostname (PEM format)
+         * @param private_key path to the private key file for the certificate (PEM format)
+         * @param handler     handler for requests to the hostname, or nullptr to use respond_async()
+         * @throws std::invalid_argument if the hostname is empty or was already added
+         * @throws std::runtime_error    if the certificate or private key could not be loaded
+         */
+        void add_virtual_host(const std::string &hostname, const std::filesystem::path &certificate, const std::filesystem::path &private_key, VirtualHostHandler handler = nullptr);
+        
+        /**
+         * Replace a virtual host's certificate and private key the same way as reload_certificate(). This can be called while accepting clients, and it's thread-safe.
+         * @param hostname    hostname given to add_virtual_host()
+         * @param certificate path to the certificate (chain) file (PEM format)
+         * @param private_key path to the private key file for the certificate (PEM format)
+         * @throws std::invalid_argument if the hostname isn't a virtual host
+         * @throws std::runtime_error    if the certificate or private key could not be loaded (the current ones are kept)
+         */
+        void reload_virtual_host_certificate(const std::string &hostname, const std::filesystem::path &certificate, const std::filesystem::path &private_key);
+        
+        /**
+         * Enable or disable kernel TLS (SSL_OP_ENABLE_KTLS). This is enabled by default. When the kernel supports it for the negotiated cipher, ResponseFile data is sent with SSL_sendfile; otherwise, it is copied and encrypted in user space. This must not be called while accepting clients.
+         * @param enabled enable kernel TLS
+         */
+        void set_kernel_tls(bool enabled);
+        
+        /**
+         * Get statistics for which path ResponseFile data took. This function is thread-safe.
+         * @return statistics
+         */
+        FileTransferStatistics get_file_transfer_statistics() const noexcept;
+        
+        /**
+         * Set the size of the server-side TLS session cache. This is 20480 sessions with a 2 hour lifetime by default.
+         *
+         * Gemini opens a new connection for every request, so letting returning clients resume their session instead of doing a full
+         * handshake saves a lot of CPU time. The lifetime also applies to session tickets.
+         * @param size     maximum number of cached sessions, or 0 to disable the cache
+         * @param lifetime how long a session can be resumed for
+         */
+        void set_session_cache(std::size_t size, std::chrono::seconds lifetime = std::chrono::hours(2));
+        
+        /**
+         * Enable or disable TLS session tickets. These are enabled by default, with keys rotated every hour.
+         *
+         * Tickets let clients resume sessions without the server storing them. Keys are generated randomly in memory and kept for as long as
+         * they can decrypt an unexpired ticket.
+         * @param enabled               enable session tickets
+         * @param key_rotation_interval how long each key is used to encrypt new tickets
+         */
+        void set_session_tickets(bool enabled, std::chrono::seconds key_rotation_interval = std::chrono::hours(1));
+        
+        /**
+         * Get session resumption statistics. This function is thread-safe.
+         * @return statistics
+         */
+        SessionStatistics get_session_statistics() const noexcept;
+        
+        /**
+         * Set the size of the response cache, which holds responses given a TTL with Response::set_cache_ttl(). This is 64 MiB by default.
+         * @param max_bytes maximum number of bytes to cache, or 0 to disable the cache
+         */
+        void set_response_cache_size(std::size_t max_bytes);
+        
+        /**
+         * Drop all cached responses. This function is thread-safe.
+         */
+        void clear_response_cache() noexcept;
+        
+        /**
+         * Get response cache statistics. This function is thread-safe.
+         * @return statistics
+         */
+        ResponseCacheStatistics get_response_cache_statistics() const;
+        
+        /**
+         * Deadlines for each phase of a connection. A client that doesn't finish a phase in time is disconnected.
+         */
+        struct Timeouts {
+            /** Time allowed to complete the TLS handshake */
+            std::chrono::milliseconds handshake = std::chrono::seconds(10);
+            
+            /** Time allowed to send the whole request line after the handshake */
+            std::chrono::milliseconds request = std::chrono::seconds(10);
+            
+            /** Time allowed for the client to accept any response data before giving up (reset each time it accepts some) */
+            std::chrono::milliseconds write = std::chrono::seconds(30);
+        };
+        
+        /**
+         * Set the connection deadlines. Any deadline set to 0 is disabled. This must not be called while accepting clients.
+         *
+         * Deadlines are kept on a timer wheel with a resolution of 100 ms, so clients may be disconnected up to 100 ms late.
+         * @param timeouts deadlines to use
+         */
+        void set_timeouts(const Timeouts &timeouts);
+        
+        /**
+         * Get the number of clients disconnected for missing a deadline. This function is thread-safe.
+         * @return statistics
+         */
+        TimeoutStatistics get_timeout_statistics() const noexcept;
+        
+        /**
+         * Per-address limits. Addresses are IPv4 addresses, or IPv6 /64 prefixes (since a single host is usually given a whole /64).
+         */
+        struct RateLimits {
+            /** Requests each address can make per second on average, or 0 for no limit */
+            double requests_per_second = 0.0;
+            
+            /** Requests each address can make at once before being slowed down (at most 16383); if 0, one second's worth of requests */
+            unsigned int burst = 0;
+            
+            /** Connections each address can have open at once, or 0 for no limit */
+            unsigned int connections = 0;
+            
+            /** Number of addresses that can be tracked at once */
+            std::size_t table_size = 65536;
+        };
+        
+        /**
+         * Set per-address limits. These are disabled by default. This must not be called while accepting clients.
+         *
+         * A client over either limit is answered with 44 (slow down) and the number of seconds to wait before respond() is called. Clients over the connection limit still do a TLS handshake so they can be told this, but they don't count towards the limit.
+         * @param limits limits to use
+         * @throws std::invalid_argument if the limits are invalid
+         */
+        void set_rate_limits(const RateLimits &limits);
+        
+        /**
+         * Get the number of clients that were slowed down. This function is thread-safe.
+         * @return statistics
+         */
+        RateLimitStatistics get_rate_limit_statistics() const noexcept;
+        
+        /**
+         * Get connection counts, response counts, and how long each phase of serving clients took. This function is thread-safe.
+         * @return statistics
+         */
+        ServerStatistics get_statistics() const;
+        
+        /**
+         * Get the server's statistics (including timeouts, session resumption, and the response cache) in the Prometheus text format. This function is thread-safe.
+         * @return text
+         */
+        std::string get_prometheus_metrics() const;
+        
+        /**
+         * Answer requests for a path with get_prometheus_metrics() instead of calling respond(). This is disabled by default. Anyone who can connect can read it, so use a path that's hard to guess or keep the server private. This must not be called while accepting clients.
+         * @param path path to answer (e.g. "/.well-known/metrics", matched as sent by the client), or an empty string to disable it
+         */
+        void set_status_path(const std::string &path);
+        
         /**
          * Begin accepting clients. This blocks until after shutdown() is called and all clients have disconnected. The TLS certificate and key must be set before this is called. This must not be called while clients are connected.
-         * 
-         * @param maximum_parallel_connections Maximum number of parallel connections. Setting to 0 disables multi-threading. If this is exceeded, clients will have to wait.
+         *
+         * @param maximum_parallel_connections Maximum number of parallel connections. Setting to 0 disables multi-threading. If this is exceeded, clients will have to wait. With ConnectionEngine::Threaded, this is the number of worker threads unless set_worker_pool() says otherwise.
          */
         void accept_clients(unsigned long maximum_parallel_connections = 256);
         
         /**
-         * Stop accepting clients. Clients still connected will not be immediately dropped. Block until all clients have disconnected. This function is thread-safe, but it will cause a deadlock if called within respond().
+         * Stop accepting clients. Clients still connected will not be immediately dropped. Block until all clients have disconnected and accept_clients() has returned. This function is thread-safe, but it will cause a deadlock if called within respond().
          */
         void shutdown();
         
+        /**
+         * Stop accepting clients, and give the clients still connected until the deadline to finish. Any clients still connected after the deadline are disconnected. Block until all clients have disconnected and accept_clients() has returned. This function is thread-safe, but it will cause a deadlock if called within respond().
+         *
+         * @param drain_deadline how long to wait for clients to finish
+         * @return true if all clients finished before the deadline, false if some had to be disconnected
+         */
+        bool shutdown(std::chrono::steady_clock::duration drain_deadline);
+        
         /**
          * Destroy the server and free resources.
          */
         virtual ~Server() = 0;
-        
+    
     protected:
         /**
-         * Callback for receiving a request
+         * Callback for receiving a request. Either this or respond_async() must be overridden.
          * @param url    URL being retrieved
          * @param client client information
          */
-        virtual Response respond(const URI &url, const Client &client) = 0;
+        virtual Response respond(const URI &url, const Client &client);
+        
+        /**
+         * Callback for receiving a request that can be answered later. By default, this calls respond() and passes its response to the callback right away.
+         *
+         * Override this instead of respond() to wait on something (such as a database or another server) without blocking. The URL and client stay valid until the callback is called. With ConnectionEngine::Epoll, the connection is set aside and its event loop serves other clients in the meantime. With ConnectionEngine::Threaded, the client's thread waits for the callback.
+         *
+         * If this throws, the callback must not be called.
+         *
+         * @param url      URL being retrieved
+         * @param client   client information
+         * @param callback callback to call with the response
+         */
+        virtual void respond_async(const URI &url, const Client &client, ResponseCallback callback);
         
         /**
          * Instantiate a server, binding to the given hostname/ip and port.
@@ -73,10 +413,19 @@ namespace Mousygem {
          * @param port        TCP port to bind to
          */
         Server(const char *ip_hostname = nullptr, std::uint16_t port = DEFAULT_GEMINI_PORT);
-        
+    
     private:
-        /** SSL context */
-        std::unique_ptr<SSLContext> ssl_context;
+        /** SSL context for new connections (swapped by reload_certificate(), so load it with get_ssl_context() while accepting clients) */
+        std::shared_ptr<SSLContext> ssl_context;
+        
+        /** Mutex for reloading certificates */
+        std::mutex reload_mutex;
+        
+        /** Get the SSL context for a new connection. This function is thread-safe. */
+        std::shared_ptr<SSLContext> get_ssl_context() const;
+        
+        /** Set the callbacks for serving connections on the server's SSL context */
+        void set_up_ssl_context(SSLContext &context);
         
         /** Implementation-specific socket address */
         std::unique_ptr<SocketAddress> address;
@@ -84,23 +433,166 @@ namespace Mousygem {
         /** Number of currently connected clients */
         unsigned long connected_clients = 0;
         
-        /** Mutex for the connected clients count *?
-        std::mutex connected_clients_mutex;
+        /** Currently connected clients, linked through the clients themselves (so they can be disconnected if they don't finish in time) */
+        Client *connected_client_list = nullptr;
+        
+        /** Mutex for the connected clients and server_running */
+        mutable std::mutex connected_clients_mutex;
+        
+        /** Signalled when a client disconnects or accept_clients() returns */
+        std::condition_variable connected_clients_changed;
         
         /** Server running? */
-        bool server_running = false;
+        std::atomic<bool> server_running = false;
         
         /** Shutting down? */
-        std::mutex shutdown_mutex;
+        std::atomic<bool> shutting_down = false;
+        
+        /** eventfd signalled by shutdown() to interrupt a blocked accept */
+        int shutdown_event = -1;
+        
+        /** Number of ResponseFile responses sent with SSL_sendfile */
+        std::atomic<std::uint64_t> sendfile_responses = 0;
         
-        /** Mutex */
-        std::mutex connected_clients_mutex;
+        /** Number of ResponseFile responses copied through user space */
+        std::atomic<std::uint64_t> copied_responses = 0;
+        
+        /** Number of handshakes that resumed a session */
+        std::atomic<std::uint64_t> resumed_handshakes = 0;
+        
+        /** Number of handshakes that didn't resume a session */
+        std::atomic<std::uint64_t> full_handshakes = 0;
+        
+        /** Session lifetime (also used for ticket key rotation) */
+        std::chrono::seconds session_lifetime = std::chrono::hours(2);
+        
+        /** How often to rotate session ticket keys */
+        std::chrono::seconds session_ticket_rotation = std::chrono::hours(1);
+        
+        /** Cached responses (nullptr if disabled) */
+        std::unique_ptr<ResponseCache> response_cache;
+        
+        /** Connection deadlines */
+        Timeouts timeouts;
+        
+        /** Number of clients disconnected for missing each deadline */
+        std::atomic<std::uint64_t> handshake_timeouts = 0;
+        std::atomic<std::uint64_t> request_timeouts = 0;
+        std::atomic<std::uint64_t> write_timeouts = 0;
+        
+        /** Deadlines for the threaded engine (nullptr until clients are first accepted, then persists between calls to accept_clients()) */
+        std::unique_ptr<TimerThread> timer_thread;
+        
+        /** Count a client that missed a deadline for a phase (a ConnectionPhase) */
+        void count_timeout(int phase) noexcept;
+        
+        /** Counters and latency histograms */
+        std::unique_ptr<ServerMetrics> metrics;
+        
+        /** Per-address limits (nullptr if disabled) */
+        std::unique_ptr<RateLimiter> rate_limiter;
+        
+        /** Path answered with get_prometheus_metrics() (empty if disabled) */
+        std::string status_path;
+        
+        /** Hashes hostnames ignoring case, so they can be looked up as sent without making a lowercase copy */
+        struct HostnameHash {
+            std::size_t operator()(std::string_view hostname) const noexcept;
+        };
+        
+        /** Compares hostnames ignoring case */
+        struct HostnameEqual {
+            bool operator()(std::string_view a, std::string_view b) const noexcept;
+        };
+        
+        /** Virtual hosts by hostname (each key views its host's lowercase hostname) */
+        std::unordered_map<std::string_view, std::unique_ptr<VirtualHost>, HostnameHash, HostnameEqual> virtual_hosts;
+        
+        /** Find the virtual host for a hostname (nullptr if there isn't one) */
+        const VirtualHost *find_virtual_host(std::string_view hostname) const;
+        
+        /** Count a completed handshake */
+        void handshake_completed(void *ssl_handle) noexcept;
+        
+        /** Set up a writer for a response, choosing sendfile if kernel TLS is active, and count which path it took */
+        static void begin_response(Server *server, void *ssl_handle, Response &response, std::optional<ResponseWriter> &writer);
+        
+        /** Count a newly connected client */
+        void client_connected(Client *client);
+        
+        /** Stop counting a client, close its socket, give it back to its shard's pool, and wake up anyone waiting on it. Anything using its memory must be gone first. */
+        void client_disconnected(Client *client) noexcept;
+        
+        /** Accept clients from a shard until shutting down */
+        void accept_loop(AcceptorShard &shard, unsigned long maximum_parallel_connections);
+        
+        /** Stop accepting clients and wait for everything to finish */
+        bool shutdown_and_wait(std::optional<std::chrono::steady_clock::duration> drain_deadline);
         
         /** Serve the client (thread) */
-        static void serve_client(Server *server, void *ssl_handle, Client *client) noexcept;
+        static void serve_client(Server *server, Client *client) noexcept;
+        
+        /** Get the response for a request line that was read (or failed to be read) from a client, waiting for it if needed. The response is always safe to send. */
+        static Response handle_request(Server *server, void *ssl_handle, const char *request, std::size_t request_size, bool request_ok, Client *client) noexcept;
+        
+        /** Parse a request line, and answer it if it's invalid or cached. Otherwise, return nothing and set uri, and respond_async() needs to be called. */
+        static std::optional<Response> begin_request(Server *server, void *ssl_handle, const char *request, std::size_t request_size, bool request_ok, Client *client, std::optional<URI> &uri) noexcept;
+        
+        /** Cache a response if it came from respond_async() (uri is set), and make sure it's safe to send */
+        static Response finish_request(Server *server, const URI *uri, const Client &client, Response response) noexcept;
+        
+        /** Call the client's virtual host's handler if it has one, or else respond_async() */
+        void dispatch_request(const URI &uri, const Client &client, ResponseCallback callback);
+        
+        /** Call dispatch_request() and wait for the callback */
+        Response wait_for_response(const URI &uri, const Client &client);
+        
+        /** Create, bind, and listen on a socket for our address */
+        int open_listening_socket(bool non_blocking, bool reuse_port);
         
         /** Serve on both ipv4/ipv6 */
         bool ipv4_and_ipv6 = false;
+        
+        /** Engine used for serving clients */
+        ConnectionEngine connection_engine = ConnectionEngine::Threaded;
+        
+        /** Number of event loop threads for the epoll engine (0 = hardware concurrency) */
+        unsigned int epoll_loop_threads = 0;
+        
+        /** Currently running epoll engine, if any */
+        EpollEngine *running_engine = nullptr;
+        
+        /** Mutex for running_engine */
+        std::mutex running_engine_mutex;
+        
+        /** Worker pool for the threaded engine (persists between calls to accept_clients()) */
+        std::unique_ptr<WorkerPool> worker_pool;
+        
+        /** Mutex for worker_pool */
+        mutable std::mutex worker_pool_mutex;
+        
+        /** Worker pool configuration */
+        std::size_t worker_threads = 0;
+        std::size_t worker_queue_capacity = 0;
+        Backpressure worker_backpressure = Backpressure::Block;
+        
+        /** Listening socket options */
+        ListenOptions listen_options;
+        
+        /** Number of acceptor shards (0 = hardware concurrency) */
+        unsigned int acceptor_shard_count = 1;
+        
+        /** Pin acceptor threads to CPUs? */
+        bool pin_acceptors_to_cpus = false;
+        
+        /** Listening sockets given to use_listening_sockets(), waiting for accept_clients() */
+        std::vector<int> adopted_sockets;
+        
+        /** Acceptor shards (kept after accept_clients() returns for statistics) */
+        std::vector<std::unique_ptr<AcceptorShard>> acceptor_shards;
+        
+        /** Mutex for acceptor_shards */
+        mutable std::mutex acceptor_shards_mutex;
     };
 }
 
@@ -0,0 +1,141 @@
+#ifndef MOUSYGEM__STATIC_FILES_HPP
+#define MOUSYGEM__STATIC_FILES_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "response.hpp"
+#include "statistics.hpp"
+
+namespace Mousygem {
+    class URI;
+    
+    /**
+     * Serves files from a directory, keeping recently requested files in memory.
+     *
+     * Call respond() from your Server's respond() for requests that should be served from the directory. Cached files are served without
+     * touching the filesystem, and are checked for changes (by inode, size, and modification time) at most once per revalidation interval.
+     * Files too large to cache are sent straight from disk.
+     *
+     * Paths containing ".." segments, and files that resolve (through symlinks) to somewhere outside of the directory, are never served.
+     */
+    class StaticFiles {
+    public:
+        /**
+         * Serve a directory
+         * @param root       directory to serve
+         * @param cache_size maximum number of bytes of file data to keep in memory
+         * @throws std::filesystem::filesystem_error if the directory does not exist
+         */
+        StaticFiles(const std::filesystem::path &root, std::size_t cache_size = 64 * 1024 * 1024);
+        
+        /**
+         * Respond to a request. This function is thread-safe.
+         * @param uri URI requested
+         * @return response
+         */
+        Response respond(const URI &uri);
+        
+        /**
+         * Set the largest file that will be cached. Larger files are read from disk every time they're requested. This is 1 MiB by default.
+         * This is not thread-safe, so call it before serving any requests.
+         * @param size maximum size in bytes
+         */
+        void set_max_cached_file_size(std::size_t size) noexcept {
+            this->max_cached_file_size = size;
+        }
+        
+        /**
+         * Set how long a cached file is served before checking if it changed. This is 1 second by default. This is not thread-safe, so call it before serving any requests.
+         * @param interval interval (0 to check on every request)
+         */
+        void set_revalidate_interval(std::chrono::milliseconds interval) noexcept {
+            this->revalidate_interval = interval;
+        }
+        
+        /**
+         * Set the file served when a directory is requested. This is "index.gmi" by default. This is not thread-safe, so call it before serving any requests.
+         * @param name file name
+         */
+        void set_index_file(const std::string &name) {
+            this->index_file = name;
+        }
+        
+        /**
+         * Set the MIME type for files with an extension, overriding the built-in type (if any). This is not thread-safe, so call it before serving any requests.
+         * @param extension extension without the dot (e.g. "gmi"), matched case-insensitively
+         * @param mime_type MIME type to send
+         */
+        void set_mime_type(const std::string &extension, const std::string &mime_type);
+        
+        /**
+         * Drop all cached files. This function is thread-safe.
+         */
+        void clear_cache() noexcept;
+        
+        /**
+         * Get cache statistics. This function is thread-safe.
+         * @return statistics
+         */
+        StaticFileStatistics get_statistics() const;
+        
+        StaticFiles(const StaticFiles &) = delete;
+        StaticFiles &operator =(const StaticFiles &) = delete;
+    
+    private:
+        struct CachedFile {
+            /** Sanitized request path */
+            std::string key;
+            
+            /** File that was read (the index file for directories) */
+            std::filesystem::path file_path;
+            
+            std::shared_ptr<const std::vector<std::byte>> data;
+            std::string mime_type;
+            
+            /** Used to tell if the file changed */
+            std::uint64_t device;
+            std::uint64_t inode;
+            std::int64_t modified_ns;
+            std::uint64_t size;
+            
+            /** When we last checked if the file changed */
+            std::chrono::steady_clock::time_point checked;
+        };
+        
+        std::filesystem::path root;
+        std::size_t cache_size;
+        std::size_t max_cached_file_size = 1024 * 1024;
+        std::chrono::milliseconds revalidate_interval = std::chrono::seconds(1);
+        std::string index_file = "index.gmi";
+        std::unordered_map<std::string, std::string> mime_types;
+        
+        /** Cached files, most recently used first */
+        mutable std::mutex cache_mutex;
+        std::list<CachedFile> cache;
+        std::unordered_map<std::string, std::list<CachedFile>::iterator> cache_index;
+        std::size_t cached_bytes = 0;
+        
+        /** Statistics (guarded by cache_mutex) */
+        StaticFileStatistics statistics;
+        
+        /** Find the MIME type for a file */
+        std::string mime_type_for(const std::filesystem::path &path) const;
+        
+        /** Add a file to the cache, evicting others to make room (cache_mutex must be held) */
+        void insert(CachedFile &&file);
+        
+        /** Remove a file from the cache (cache_mutex must be held) */
+        void erase(std::list<CachedFile>::iterator file) noexcept;
+    };
+}
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef MOUSYGEM__STATISTICS_HPP
+#define MOUSYGEM__STATISTICS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Mousygem {
+    /**
+     * Worker pool statistics
+     */
+    struct WorkerPoolStatistics {
+        /** Number of worker threads */
+        std::size_t threads = 0;
+        
+        /** Maximum number of clients that can wait in the queue */
+        std::size_t queue_capacity = 0;
+        
+        /** Number of clients currently waiting in the queue */
+        std::size_t queue_depth = 0;
+        
+        /** Highest number of clients that waited in the queue at once */
+        std::size_t peak_queue_depth = 0;
+        
+        /** Number of clients served by the workers */
+        std::uint64_t jobs_completed = 0;
+        
+        /** Number of clients dropped because the queue was full (only with Server::Backpressure::Reject) */
+        std::uint64_t jobs_rejected = 0;
+        
+        /** Total time clients spent in the queue before a worker picked them up */
+        std::chrono::nanoseconds total_queue_wait_time = {};
+        
+        /** Longest time a client spent in the queue before a worker picked it up */
+        std::chrono::nanoseconds max_queue_wait_time = {};
+    };
+    
+    /**
+     * Acceptor shard statistics
+     */
+    struct AcceptorShardStatistics {
+        /** CPU the acceptor is pinned to, or -1 if it is not pinned */
+        int cpu = -1;
+        
+        /** Total number of connections accepted by this shard */
+        std::uint64_t connections_accepted = 0;
+        
+        /** Number of connections accepted by this shard that are still connected */
+        std::uint64_t connections_active = 0;
+    };
+    
+    /**
+     * Statistics for responses sent from a ResponseFile
+     */
+    struct FileTransferStatistics {
+        /** Responses sent with kernel TLS and SSL_sendfile (no copies through user space) */
+        std::uint64_t sendfile_responses = 0;
+        
+        /** Responses read into a buffer and encrypted in user space (kernel TLS was unavailable or disabled) */
+        std::uint64_t copied_responses = 0;
+    };
+    
+    /**
+     * TLS session resumption statistics
+     */
+    struct SessionStatistics {
+        /** Handshakes that resumed a session (from the session cache or a session ticket) */
+        std::uint64_t resumed_handshakes = 0;
+        
+        /** Handshakes that could not resume a session */
+        std::uint64_t full_handshakes = 0;
+        
+        /** Sessions in the server-side session cache */
+        std::uint64_t cached_sessions = 0;
+        
+        /** Session ticket keys generated so far */
+        std::uint64_t ticket_key_rotations = 0;
+    };
+    
+    /**
+     * StaticFiles cache statistics
+     */
+    struct StaticFileStatistics {
+        /** Requests served from the cache */
+        std::uint64_t hits = 0;
+        
+        /** Requests that had to read the file */
+        std::uint64_t misses = 0;
+        
+        /** Times a cached file was checked for changes */
+        std::uint64_t revalidations = 0;
+        
+        /** Cached files dropped because they changed on disk */
+        std::uint64_t invalidations = 0;
+        
+        /** Cached files dropped to make room for others */
+        std::uint64_t evictions = 0;
+        
+        /** Files in the cache */
+        std::size_t cached_files = 0;
+        
+        /** Bytes of file data in the cache */
+        std::size_t cached_bytes = 0;
+    };
+    
+    /**
+     * Response cache statistics
+     */
+    struct ResponseCacheStatistics {
+        /** Requests answered from the cache without calling respond() */
+        std::uint64_t hits = 0;
+        
+        /** Requests that had to call respond() */
+        std::uint64_t misses = 0;
+        
+        /** Responses added to the cache */
+        std::uint64_t stores = 0;
+        
+        /** Responses dropped because they expired or to make room */
+        std::uint64_t evictions = 0;
+        
+        /** Responses in the cache */
+        std::size_t entries = 0;
+        
+        /** Bytes of keys, headers, and data in the cache (excluding mapped files) */
+        std::size_t bytes = 0;
+    };
+    
+    /**
+     * Connection deadline statistics
+     */
+    struct TimeoutStatistics {
+        /** Clients disconnected for not finishing the TLS handshake in time */
+        std::uint64_t handshake_timeouts = 0;
+        
+        /** Clients disconnected for not sending a complete request line in time */
+        std::uint64_t request_timeouts = 0;
+        
+        /** Clients disconnected for not accepting any response data in time */
+        std::uint64_t write_timeouts = 0;
+    };
+    
+    /**
+     * Rate limiting statistics
+     */
+    struct RateLimitStatistics {
+        /** Requests answered with 44 (slow down) for going over the request rate */
+        std::uint64_t rate_limited = 0;
+        
+        /** Connections answered with 44 (slow down) for going over the connection limit */
+        std::uint64_t connection_limited = 0;
+        
+        /** Connections that weren't limited because the table of addresses was full */
+        std::uint64_t untracked = 0;
+    };
+    
+    /**
+     * Requests handled by a route
+     */
+    struct RouteStatistics {
+        /** Pattern the route was added with */
+        std::string pattern;
+        
+        /** Requests it handled */
+        std::uint64_t hits = 0;
+    };
+    
+    /**
+     * Router statistics
+     */
+    struct RouterStatistics {
+        /** Each route, in the order they were added */
+        std::vector<RouteStatistics> routes;
+        
+        /** Requests that didn't match any route */
+        std::uint64_t unmatched = 0;
+    };
+    
+    /**
+     * Latency histogram.
+     *
+     * Samples are counted in log-linear buckets: each power of two is split into 8 buckets, so any value read from it is within 12.5% of
+     * the real one.
+     */
+    struct LatencyStatistics {
+        /** Number of samples */
+        std::uint64_t count = 0;
+        
+        /** Sum of all samples */
+        std::chrono::nanoseconds total = std::chrono::nanoseconds(0);
+        
+        /** Largest sample */
+        std::chrono::nanoseconds max = std::chrono::nanoseconds(0);
+        
+        /** Number of samples in each bucket (see get_bucket_upper_bound()) */
+        std::vector<std::uint64_t> buckets;
+        
+        /**
+         * Get a percentile
+         * @param percentile percentile from 0 to 100
+         * @return smallest bucket bound that at least this percentage of samples fall under (0 if there are no samples)
+         */
+        std::chrono::nanoseconds get_percentile(double percentile) const noexcept;
+        
+        /**
+         * Get the largest value counted in a bucket
+         * @param index index of the bucket
+         * @return bound
+         */
+        static std::chrono::nanoseconds get_bucket_upper_bound(std::size_t index) noexcept;
+    };
+    
+    /**
+     * Server statistics
+     */
+    struct ServerStatistics {
+        /** Clients accepted */
+        std::uint64_t connections_accepted = 0;
+        
+        /** Clients currently connected */
+        std::uint64_t active_connections = 0;
+        
+        /** Bytes of response headers and data sent (before encryption) */
+        std::uint64_t bytes_sent = 0;
+        
+        /** Responses sent, by response code */
+        std::array<std::uint64_t, 100> responses = {};
+        
+        /** Time from accepting a client to starting to serve it (e.g. waiting for a worker) */
+        LatencyStatistics accept_wait;
+        
+        /** Time taken by the TLS handshake */
+        LatencyStatistics handshake;
+        
+        /** Time from the end of the handshake to receiving the whole request line */
+        LatencyStatistics request_read;
+        
+        /** Time taken to get the response (including the response cache and waiting for respond_async()) */
+        LatencyStatistics respond;
+        
+        /** Time taken to send the first chunk of the response (the header and as much data as fits in the same TLS record) */
+        LatencyStatistics header_write;
+        
+        /** Time taken to send the rest of the response data */
+        LatencyStatistics body_write;
+    };
+}
+
+#endif
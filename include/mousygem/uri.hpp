@@ -1,8 +1,12 @@
 #ifndef MOUSYGEM__URI_HPP
 #define MOUSYGEM__URI_HPP
 
+#include <cstdint>
+#include <memory_resource>
 #include <optional>
+#include <ostream>
 #include <string>
+#include <string_view>
 
 namespace Mousygem {
     /**
@@ -15,10 +19,19 @@ namespace Mousygem {
         /**
          * Construct a URI
          * @param uri_string input string
-         * @throws std::invalid_argument if URI is invalid
+         * @throws std::invalid_argument if URI is invalid (including if it contains control characters)
          */
         URI(const std::string &uri_string);
         
+        /**
+         * Construct a URI, storing it in memory from a memory resource (such as Client::get_memory_resource()) instead of the heap. The resource
+         * must outlive the URI. Copies of the URI are stored on the heap as usual.
+         * @param uri_string input string
+         * @param memory     memory resource to store the URI with
+         * @throws std::invalid_argument if URI is invalid (including if it contains control characters)
+         */
+        URI(std::string_view uri_string, std::pmr::memory_resource *memory);
+        
         /**
          * Construct a URI
          * @param uri_string input string
@@ -40,38 +53,102 @@ namespace Mousygem {
          * @return string
          */
         std::string string() const {
-            return this->data;
+            return std::string(this->data);
         }
         
         /**
          * Get the hostname
          * @return hostname
          */
-        std::string hostname() const;
+        std::string hostname() const {
+            return decode_percent_encoding(this->raw_hostname());
+        }
         
         /**
          * Get the port
          * @return port
          */
-        std::optional<std::uint16_t> port() const;
+        std::optional<std::uint16_t> port() const noexcept {
+            return this->port_number;
+        }
         
         /**
          * Get the protocol
          * @return protocol
          */
-        std::string protocol() const;
+        std::string protocol() const {
+            return std::string(this->raw_protocol());
+        }
         
         /**
          * Get the input
          * @return input string
          */
-        std::optional<std::string> input() const;
+        std::optional<std::string> input() const {
+            auto input = this->raw_input();
+            if(!input.has_value()) {
+                return std::nullopt;
+            }
+            return decode_percent_encoding(*input);
+        }
         
         /**
          * Get the path
          * @return path string
          */
-        std::string path() const;
+        std::string path() const {
+            return decode_percent_encoding(this->raw_path());
+        }
+        
+        /**
+         * Get the protocol without copying it. The view is only valid for as long as the URI exists and is unmodified.
+         * @return protocol
+         */
+        std::string_view raw_protocol() const noexcept {
+            return std::string_view(this->data).substr(0, this->hostname_start - (sizeof("://") - 1));
+        }
+        
+        /**
+         * Get the hostname without decoding or copying it. The view is only valid for as long as the URI exists and is unmodified.
+         * @return percent-encoded hostname
+         */
+        std::string_view raw_hostname() const noexcept {
+            return std::string_view(this->data).substr(this->hostname_start, this->hostname_end - this->hostname_start);
+        }
+        
+        /**
+         * Get the path without decoding or copying it. The view is only valid for as long as the URI exists and is unmodified.
+         * @return percent-encoded path
+         */
+        std::string_view raw_path() const noexcept {
+            return std::string_view(this->data).substr(this->path_start, this->path_end - this->path_start);
+        }
+        
+        /**
+         * Get the input without decoding or copying it. The view is only valid for as long as the URI exists and is unmodified.
+         * @return percent-encoded input, if any
+         */
+        std::optional<std::string_view> raw_input() const noexcept {
+            if(this->path_end == this->data.size()) {
+                return std::nullopt;
+            }
+            return std::string_view(this->data).substr(this->path_end + 1);
+        }
+        
+        /**
+         * Decode percent-encoded characters into a buffer. Invalid sequences are copied as-is.
+         * @param input  percent-encoded string
+         * @param output buffer to write to (must hold at least input.size() characters)
+         * @return number of characters written
+         */
+        static std::size_t decode_percent_encoding(std::string_view input, char *output) noexcept;
+        
+        /**
+         * Decode percent-encoded characters. Invalid sequences are copied as-is.
+         * @param input percent-encoded string
+         * @return decoded string
+         */
+        static std::string decode_percent_encoding(std::string_view input);
         
         URI(const URI &) = default;
         URI &operator =(const URI &) = default;
@@ -86,7 +163,7 @@ namespace Mousygem {
         }
         
         bool operator ==(const std::string &other) const noexcept {
-            return this->data == other;
+            return std::string_view(this->data) == other;
         }
         
         bool operator !=(const std::string &other) const noexcept {
@@ -94,21 +171,20 @@ namespace Mousygem {
         }
         
     private:
-        std::string data;
-        
-        /** Find the hostname */
-        std::size_t hostname_offset() const;
+        std::pmr::string data;
         
-        /** Find the port if it exists. Throw if the port is out of range or contains non-numerical characters */
-        std::optional<std::size_t> port_offset() const;
+        /** Offsets of each component, found once when the URI is set */
+        std::uint32_t hostname_start = 0;
+        std::uint32_t hostname_end = 0;
+        std::uint32_t path_start = 0;
         
-        /** Find the path */
-        std::size_t path_offset() const;
+        /** End of the path; if this isn't the end of the data, it's followed by "?" and the input */
+        std::uint32_t path_end = 0;
         
-        /** Find the input */
-        std::optional<std::size_t> input_offset() const;
+        std::optional<std::uint16_t> port_number;
         
-        void validate();
+        /** Find the offsets. Throw if the URI is invalid */
+        void parse();
     };
     
     static inline std::ostream &operator<<(std::ostream &stream, const URI &uri) { 
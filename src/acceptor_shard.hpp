@@ -0,0 +1,73 @@
+#ifndef MOUSYGEM__ACCEPTOR_SHARD_HPP
+#define MOUSYGEM__ACCEPTOR_SHARD_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+#include <sched.h>
+
+#include "client_pool.hpp"
+#include "socket.hpp"
+
+namespace Mousygem {
+    /**
+     * A listening socket and the connections accepted from it. With SO_REUSEPORT, the server has one of these per acceptor thread.
+     */
+    struct AcceptorShard {
+        /** Most disconnected clients to keep for reuse */
+        static const constexpr std::size_t FREE_CLIENT_COUNT = 256;
+        
+        /** Listening socket */
+        Socket socket;
+        
+        /** CPU the acceptor thread is pinned to, or -1 if not pinned */
+        int cpu = -1;
+        
+        /** Total number of connections accepted */
+        std::atomic<std::uint64_t> connections_accepted = 0;
+        
+        /** Number of connections accepted from this shard that are still connected */
+        std::atomic<std::uint64_t> connections_active = 0;
+        
+        /** Clients for connections accepted from this shard */
+        ClientPool clients;
+        
+        AcceptorShard(int socket_handle, int cpu) : socket(socket_handle), cpu(cpu), clients(FREE_CLIENT_COUNT) {}
+        
+        ~AcceptorShard() {
+            this->socket.destroy();
+        }
+    };
+    
+    /**
+     * Pin the calling thread to a CPU, restoring its old affinity when destroyed
+     */
+    class ScopedCpuPin {
+    public:
+        ScopedCpuPin(int cpu) noexcept {
+            if(cpu < 0 || pthread_getaffinity_np(pthread_self(), sizeof(this->old_set), &this->old_set) != 0) {
+                return;
+            }
+            
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            this->pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        }
+        
+        ~ScopedCpuPin() noexcept {
+            if(this->pinned) {
+                pthread_setaffinity_np(pthread_self(), sizeof(this->old_set), &this->old_set);
+            }
+        }
+        
+        ScopedCpuPin(const ScopedCpuPin &) = delete;
+        ScopedCpuPin &operator =(const ScopedCpuPin &) = delete;
+    
+    private:
+        cpu_set_t old_set;
+        bool pinned = false;
+    };
+}
+
+#endif
@@ -1,11 +1,28 @@
+#include <cstdio>
+#include <new>
 #include <stdexcept>
 #include <arpa/inet.h>
 #include <mousygem/client.hpp>
+#include <openssl/x509.h>
 #include "socket.hpp"
 
 namespace Mousygem {
-    Client::Client() {}
-    Client::~Client() {}
+    Client::Client() : memory(memory_buffer.data(), memory_buffer.size()) {}
+    Client::~Client() {
+        X509_free(reinterpret_cast<X509 *>(this->peer_certificate));
+    }
+    
+    void Client::reset() noexcept {
+        X509_free(reinterpret_cast<X509 *>(this->peer_certificate));
+        this->peer_certificate = nullptr;
+        this->certificate_fingerprint.reset();
+        this->certificate.reset();
+        this->rate_limit_entry = nullptr;
+        this->over_connection_limit = false;
+        this->server_name.clear();
+        this->virtual_host = nullptr;
+        this->memory.release();
+    }
     
     std::string Client::ip_address() const {
         // Ensure we have an address
@@ -15,4 +32,29 @@ namespace Mousygem {
         
         return this->socket_address->ip_address();
     }
+    
+    const std::optional<std::vector<std::byte>> &Client::get_certificate() const noexcept {
+        std::lock_guard<std::mutex> lock(this->certificate_mutex);
+        auto *peer_certificate = reinterpret_cast<X509 *>(this->peer_certificate);
+        if(!peer_certificate || this->certificate.has_value()) {
+            return this->certificate;
+        }
+        
+        unsigned char *data = nullptr;
+        int length = i2d_X509(peer_certificate, &data);
+        if(length < 0) {
+            std::fprintf(stderr, "Failed to encode a client's certificate\n");
+            return this->certificate;
+        }
+        
+        // Leave it unset (to try again next time) if we're out of memory
+        try {
+            this->certificate = std::vector<std::byte>(reinterpret_cast<std::byte *>(data), reinterpret_cast<std::byte *>(data) + length);
+        }
+        catch(std::bad_alloc &) {
+            std::fprintf(stderr, "Failed to encode a client's certificate: out of memory\n");
+        }
+        OPENSSL_free(data);
+        return this->certificate;
+    }
 }
@@ -0,0 +1,52 @@
+#include <mousygem/client.hpp>
+
+#include "client_pool.hpp"
+#include "socket.hpp"
+
+namespace Mousygem {
+    ClientPool::ClientPool(std::size_t capacity) : capacity(capacity) {
+        this->free_clients.reserve(capacity);
+    }
+    
+    Client *ClientPool::acquire(int socket_handle, const sockaddr_storage &address, socklen_t address_size) {
+        Client *client = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if(!this->free_clients.empty()) {
+                client = this->free_clients.back();
+                this->free_clients.pop_back();
+            }
+        }
+        
+        if(!client) {
+            client = new Client;
+            client->socket = std::make_unique<Socket>();
+            client->socket_address = std::make_unique<SocketAddress>();
+        }
+        
+        client->socket->socket = socket_handle;
+        client->socket_address->ss = address;
+        client->socket_address->ss_size = address_size;
+        return client;
+    }
+    
+    void ClientPool::release(Client *client) noexcept {
+        client->reset();
+        
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if(this->free_clients.size() < this->capacity) {
+                this->free_clients.emplace_back(client);
+                return;
+            }
+        }
+        
+        delete client;
+    }
+    
+    ClientPool::~ClientPool() {
+        for(auto *client : this->free_clients) {
+            delete client;
+        }
+    }
+}
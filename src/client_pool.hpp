@@ -0,0 +1,53 @@
+#ifndef MOUSYGEM__CLIENT_POOL_HPP
+#define MOUSYGEM__CLIENT_POOL_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include <sys/socket.h>
+
+namespace Mousygem {
+    class Client;
+    
+    /**
+     * Free list of clients, so accepting a connection doesn't allocate a new Client (along with its socket, address, and memory) each time.
+     *
+     * Clients are taken by the thread accepting connections and given back from whichever thread served them. Each client keeps its memory
+     * buffer between connections, so most requests never touch the heap for it.
+     */
+    class ClientPool {
+    public:
+        /**
+         * Create a pool
+         * @param capacity most clients to keep around when they're not in use
+         */
+        ClientPool(std::size_t capacity);
+        
+        /**
+         * Take a client for a new connection, reusing one if any are free. This function is thread-safe.
+         * @param socket_handle connected socket (owned by the client from now on)
+         * @param address       address of the peer
+         * @param address_size  size of the address
+         * @return client
+         */
+        Client *acquire(int socket_handle, const sockaddr_storage &address, socklen_t address_size);
+        
+        /**
+         * Give a client back once it disconnects and its socket is closed. This function is thread-safe.
+         * @param client client from acquire()
+         */
+        void release(Client *client) noexcept;
+        
+        ~ClientPool();
+        
+        ClientPool(const ClientPool &) = delete;
+        ClientPool &operator =(const ClientPool &) = delete;
+    
+    private:
+        std::mutex mutex;
+        std::vector<Client *> free_clients;
+        std::size_t capacity;
+    };
+}
+
+#endif
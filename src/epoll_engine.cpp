@@ -0,0 +1,685 @@
+#include <mousygem/server.hpp>
+#include <mousygem/response.hpp>
+#include <mousygem/client.hpp>
+#include <mousygem/uri.hpp>
+#include <mutex>
+#include <cstdio>
+
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <openssl/err.h>
+
+#include "epoll_engine.hpp"
+#include "ssl_context.hpp"
+#include "socket.hpp"
+#include "response_writer.hpp"
+#include "acceptor_shard.hpp"
+#include "timer_wheel.hpp"
+#include "metrics.hpp"
+
+namespace Mousygem {
+    // Tags for telling apart the listening socket and the wakeup eventfd from connections in epoll_event::data
+    static char listen_tag, wake_tag;
+    
+    // Maximum number of chunks written to a single connection before letting other connections have a turn
+    static constexpr const std::size_t CHUNKS_PER_TURN = 16;
+    
+    // Most connections each loop keeps around for reuse after their clients disconnect
+    static constexpr const std::size_t FREE_CONNECTION_COUNT = 256;
+    
+    // Most writers (16 KiB each) each loop keeps around for reuse after their responses are sent
+    static constexpr const std::size_t FREE_WRITER_COUNT = 64;
+    
+    struct EpollEngine::Connection {
+        enum class State {
+            /** Doing the TLS handshake */
+            Handshake,
+            
+            /** Reading the request line */
+            ReadRequest,
+            
+            /** Waiting for respond_async() to call back */
+            Respond,
+            
+            /** Writing the response */
+            Write,
+            
+            /** Closed, waiting to be recycled once the current batch of events is done */
+            Closed
+        };
+        
+        State state = State::Handshake;
+        
+        /** TLS connection */
+        SSL *ssl = nullptr;
+        
+        /** Client information (owns the socket), from the shard's pool */
+        Client *client = nullptr;
+        
+        /** Position in the loop's connections */
+        std::size_t index = 0;
+        
+        /** Events we're waiting on */
+        std::uint32_t events = 0;
+        
+        /** Request line read so far */
+        char request[1027] = {};
+        std::size_t request_size = 0;
+        
+        /** URI requested, once it's been parsed */
+        std::optional<URI> uri;
+        
+        /** Is respond_async() being called on the loop thread right now? */
+        bool in_respond_async = false;
+        
+        /** Did the socket hang up (or get shut down by a forced drain) while respond_async() had the connection? If so, the response is thrown away when it comes back. */
+        bool abandoned = false;
+        
+        /** Response being sent */
+        std::optional<Response> response;
+        
+        /** Writer for the response, only given to the connection once it starts writing (its buffer is most of a connection's memory) */
+        std::unique_ptr<std::optional<ResponseWriter>> writer;
+        
+        /** Part of the current chunk not yet sent */
+        ResponseWriter::Chunk chunk;
+        
+        /** Deadline for the current phase */
+        TimerWheel::Timer deadline;
+        
+        /** When the current phase (for metrics) started */
+        ServerMetrics::Clock::time_point phase_start;
+        
+        /** Has the header been sent? */
+        bool header_sent = false;
+        
+        /** Bytes sent so far */
+        std::uint64_t bytes_sent = 0;
+        
+        int socket() const noexcept {
+            return *this->client->socket->socket;
+        }
+        
+        /** Clear everything from the last connection so this can be reused (the writer must already be given back, and the response and URI must be gone) */
+        void reset() noexcept {
+            this->state = State::Handshake;
+            this->ssl = nullptr;
+            this->client = nullptr;
+            this->events = 0;
+            this->request_size = 0;
+            this->in_respond_async = false;
+            this->abandoned = false;
+            this->chunk = ResponseWriter::Chunk();
+            this->header_sent = false;
+            this->bytes_sent = 0;
+        }
+    };
+    
+    class EpollEngine::Loop {
+    public:
+        Loop(EpollEngine &engine, Server &server, AcceptorShard &shard, unsigned long connection_limit, int cpu) :
+            engine(engine), server(server), shard(shard), listen_socket(*shard.socket.socket), connection_limit(connection_limit), cpu(cpu),
+            deadlines(std::chrono::milliseconds(100), 1024) {
+            this->epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+            if(this->epoll_handle < 0) {
+                throw except_latest_error("epoll_create1 failed");
+            }
+            
+            this->wake_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(this->wake_handle < 0) {
+                auto error = except_latest_error("eventfd failed");
+                close(this->epoll_handle);
+                throw error;
+            }
+            
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = &wake_tag;
+            if(epoll_ctl(this->epoll_handle, EPOLL_CTL_ADD, this->wake_handle, &event) < 0) {
+                auto error = except_latest_error("epoll_ctl failed (when adding the eventfd)");
+                close(this->wake_handle);
+                close(this->epoll_handle);
+                throw error;
+            }
+        }
+        
+        ~Loop() {
+            close(this->wake_handle);
+            close(this->epoll_handle);
+        }
+        
+        void run() noexcept {
+            ScopedCpuPin pin(this->cpu);
+            this->thread_id = std::this_thread::get_id();
+            epoll_event events[64];
+            
+            this->set_listening(true);
+            
+            while(!(this->engine.stopping && this->connections.empty())) {
+                // Wake up for the next tick if any deadlines are pending
+                int timeout = -1;
+                if(this->deadlines.size() > 0) {
+                    auto until_tick = this->deadlines.time_until_next_tick(TimerWheel::Clock::now());
+                    timeout = static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(until_tick).count());
+                }
+                
+                int event_count = epoll_wait(this->epoll_handle, events, sizeof(events) / sizeof(*events), timeout);
+                if(event_count < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    std::fprintf(stderr, "epoll_wait failed: %s\n", strerrordesc_np(errno));
+                    break;
+                }
+                
+                for(int i = 0; i < event_count; i++) {
+                    auto *ptr = events[i].data.ptr;
+                    
+                    if(ptr == &listen_tag) {
+                        this->accept_connections();
+                    }
+                    else if(ptr == &wake_tag) {
+                        eventfd_t value;
+                        eventfd_read(this->wake_handle, &value);
+                        if(this->engine.stopping) {
+                            this->set_listening(false);
+                        }
+                        this->resume_completed();
+                    }
+                    else {
+                        // Only hangups are reported while waiting on respond_async(), and closed connections' events are stale
+                        auto &connection = *reinterpret_cast<Connection *>(ptr);
+                        if(connection.state == Connection::State::Closed) {
+                            continue;
+                        }
+                        if(connection.state == Connection::State::Respond) {
+                            connection.abandoned = true;
+                        }
+                        else {
+                            this->advance(connection);
+                        }
+                    }
+                }
+                
+                // Drop anyone who missed a deadline
+                this->deadlines.advance(TimerWheel::Clock::now(), [this](TimerWheel::Timer &timer) {
+                    this->server.count_timeout(timer.kind);
+                    this->close_connection(*reinterpret_cast<Connection *>(timer.context));
+                });
+                
+                // Nothing refers to the connections closed since the last batch anymore
+                this->recycle_closed();
+            }
+            
+            // Drop anything that's left (only if epoll broke), except connections respond_async() still has, which have to stay until it calls back
+            for(auto i = this->connections.size(); i > 0; i--) {
+                auto &connection = *this->connections[i - 1];
+                if(connection.state == Connection::State::Respond) {
+                    connection.abandoned = true;
+                    ::shutdown(connection.socket(), SHUT_RDWR);
+                }
+                else {
+                    this->close_connection(connection);
+                }
+            }
+            while(!this->connections.empty()) {
+                pollfd wake = {};
+                wake.fd = this->wake_handle;
+                wake.events = POLLIN;
+                poll(&wake, 1, -1);
+                
+                eventfd_t value;
+                eventfd_read(this->wake_handle, &value);
+                this->resume_completed();
+            }
+            this->recycle_closed();
+        }
+        
+        void wake() noexcept {
+            eventfd_write(this->wake_handle, 1);
+        }
+    
+    private:
+        EpollEngine &engine;
+        Server &server;
+        AcceptorShard &shard;
+        int listen_socket;
+        unsigned long connection_limit;
+        
+        /** CPU to pin to (-1 if not pinned) */
+        int cpu;
+        
+        int epoll_handle = -1;
+        int wake_handle = -1;
+        
+        /** Is the listening socket registered? */
+        bool listening = false;
+        
+        /** Thread running the loop */
+        std::thread::id thread_id;
+        
+        /** Responses from respond_async() called back on other threads, waiting for the loop to pick them up */
+        std::vector<std::pair<Connection *, Response>> completed;
+        std::mutex completed_mutex;
+        
+        /** Responses being resumed (swapped with completed, keeping both buffers around) */
+        std::vector<std::pair<Connection *, Response>> resuming;
+        
+        /** Connections owned by this loop (each knows its index) */
+        std::vector<std::unique_ptr<Connection>> connections;
+        
+        /** Connections closed during the current batch of events, which may still have events in it */
+        std::vector<std::unique_ptr<Connection>> closed_connections;
+        
+        /** Connections kept from clients that disconnected, to reuse for new ones */
+        std::vector<std::unique_ptr<Connection>> free_connections;
+        
+        /** Writers kept from sent responses, to reuse for new ones */
+        std::vector<std::unique_ptr<std::optional<ResponseWriter>>> free_writers;
+        
+        /** Deadlines for this loop's connections */
+        TimerWheel deadlines;
+        
+        void set_listening(bool listen) noexcept {
+            if(listen && !this->listening && !this->engine.stopping) {
+                epoll_event event = {};
+                event.events = EPOLLIN | EPOLLEXCLUSIVE;
+                event.data.ptr = &listen_tag;
+                this->listening = epoll_ctl(this->epoll_handle, EPOLL_CTL_ADD, this->listen_socket, &event) == 0;
+            }
+            else if(!listen && this->listening) {
+                // EPOLLEXCLUSIVE registrations can't be modified, so remove it entirely
+                epoll_ctl(this->epoll_handle, EPOLL_CTL_DEL, this->listen_socket, nullptr);
+                this->listening = false;
+            }
+        }
+        
+        void accept_connections() noexcept {
+            // Drain the backlog
+            while(this->connections.size() < this->connection_limit) {
+                sockaddr_storage client_address;
+                socklen_t client_address_length = sizeof(sockaddr_storage);
+                auto client_handle = accept4(this->listen_socket, reinterpret_cast<sockaddr *>(&client_address), &client_address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if(client_handle < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    break;
+                }
+                
+                auto *ssl = SSL_new(this->server.get_ssl_context()->get_context());
+                if(!ssl) {
+                    close(client_handle);
+                    continue;
+                }
+                SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+                SSL_set_fd(ssl, client_handle);
+                
+                std::unique_ptr<Connection> connection;
+                if(this->free_connections.empty()) {
+                    connection = std::make_unique<Connection>();
+                }
+                else {
+                    connection = std::move(this->free_connections.back());
+                    this->free_connections.pop_back();
+                }
+                connection->ssl = ssl;
+                connection->client = this->shard.clients.acquire(client_handle, client_address, client_address_length);
+                connection->client->shard = &this->shard;
+                connection->deadline.context = connection.get();
+                
+                this->server.client_connected(connection->client);
+                connection->phase_start = this->server.metrics->record(LatencyPhase::AcceptWait, connection->client->accepted_at);
+                this->set_deadline(*connection, ConnectionPhase::Handshake, this->server.timeouts.handshake);
+                
+                auto &connection_ref = *connection;
+                connection->index = this->connections.size();
+                this->connections.emplace_back(std::move(connection));
+                this->advance(connection_ref);
+            }
+            
+            // Stop listening if we're full. We'll start again when someone disconnects.
+            if(this->connections.size() >= this->connection_limit) {
+                this->set_listening(false);
+            }
+        }
+        
+        /** Wait for the given events on a connection. Return false on failure. */
+        bool watch(Connection &connection, std::uint32_t events) noexcept {
+            if(connection.events == events) {
+                return true;
+            }
+            
+            epoll_event event = {};
+            event.events = events;
+            event.data.ptr = &connection;
+            
+            auto operation = connection.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            if(epoll_ctl(this->epoll_handle, operation, connection.socket(), &event) < 0) {
+                return false;
+            }
+            
+            connection.events = events;
+            return true;
+        }
+        
+        /** Handle an SSL call that didn't succeed. Return true if we're now waiting on the socket, false if the connection failed. */
+        bool wait_for_ssl(Connection &connection, int result) noexcept {
+            switch(SSL_get_error(connection.ssl, result)) {
+                case SSL_ERROR_WANT_READ:
+                    return this->watch(connection, EPOLLIN);
+                case SSL_ERROR_WANT_WRITE:
+                    return this->watch(connection, EPOLLOUT);
+                default:
+                    return false;
+            }
+        }
+        
+        /** Set (or clear, if the timeout is 0) the deadline for the phase the connection is in */
+        void set_deadline(Connection &connection, ConnectionPhase phase, std::chrono::milliseconds timeout) noexcept {
+            if(timeout.count() > 0) {
+                connection.deadline.kind = static_cast<int>(phase);
+                this->deadlines.schedule(connection.deadline, timeout);
+            }
+            else {
+                this->deadlines.cancel(connection.deadline);
+            }
+        }
+        
+        /** Get the response, or set the connection aside until respond_async() calls back */
+        void respond(Connection &connection, bool request_ok) noexcept {
+            if(request_ok) {
+                connection.phase_start = this->server.metrics->record(LatencyPhase::RequestRead, connection.phase_start);
+            }
+            
+            auto request_size = request_ok ? connection.request_size - 2 : 0;
+            auto response = Server::begin_request(&this->server, connection.ssl, connection.request, request_size, request_ok, connection.client, connection.uri);
+            if(response.has_value()) {
+                this->begin_write(connection, std::move(*response));
+                return;
+            }
+            
+            // The handler's time doesn't count against the client
+            connection.state = Connection::State::Respond;
+            this->deadlines.cancel(connection.deadline);
+            
+            connection.in_respond_async = true;
+            try {
+                this->server.dispatch_request(*connection.uri, *connection.client, [this, connection_ptr = &connection](Response response) {
+                    this->complete(*connection_ptr, std::move(response));
+                });
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "Exception error when handling request: %s\n", e.what());
+                connection.response.emplace(Response::TemporaryFailure, "server error");
+            }
+            connection.in_respond_async = false;
+            
+            // Answered right away?
+            if(connection.response.has_value()) {
+                this->finish_respond(connection);
+                return;
+            }
+            
+            // Nothing to read or write until it calls back, but keep the socket in epoll to hear (once) if it hangs up or a forced drain shuts it down
+            if(!this->watch(connection, EPOLLONESHOT)) {
+                connection.abandoned = true;
+            }
+        }
+        
+        /** Called back by respond_async() on any thread */
+        void complete(Connection &connection, Response response) noexcept {
+            // Only the loop thread touches in_respond_async, so check which thread this is first
+            if(std::this_thread::get_id() == this->thread_id && connection.in_respond_async) {
+                connection.response.emplace(std::move(response));
+                return;
+            }
+            
+            // Hand it to the loop thread
+            {
+                std::lock_guard<std::mutex> lock(this->completed_mutex);
+                this->completed.emplace_back(&connection, std::move(response));
+            }
+            this->wake();
+        }
+        
+        /** Resume connections whose responses came back from other threads */
+        void resume_completed() noexcept {
+            {
+                std::lock_guard<std::mutex> lock(this->completed_mutex);
+                this->resuming.swap(this->completed);
+            }
+            
+            for(auto &[connection, response] : this->resuming) {
+                if(connection->abandoned) {
+                    SSL_set_quiet_shutdown(connection->ssl, 1);
+                    this->close_connection(*connection);
+                    continue;
+                }
+                connection->response.emplace(std::move(response));
+                this->finish_respond(*connection);
+                this->advance(*connection);
+            }
+            this->resuming.clear();
+        }
+        
+        /** Cache and check the response from respond_async(), which is in connection.response */
+        void finish_respond(Connection &connection) noexcept {
+            auto response = std::move(*connection.response);
+            connection.response.reset();
+            this->begin_write(connection, Server::finish_request(&this->server, &*connection.uri, *connection.client, std::move(response)));
+        }
+        
+        /** Begin writing the response */
+        void begin_write(Connection &connection, Response response) noexcept {
+            connection.phase_start = this->server.metrics->record(LatencyPhase::Respond, connection.phase_start);
+            connection.response.emplace(std::move(response));
+            
+            // Only now does the connection need a writer
+            if(!this->free_writers.empty()) {
+                connection.writer = std::move(this->free_writers.back());
+                this->free_writers.pop_back();
+            }
+            else {
+                try {
+                    connection.writer = std::make_unique<std::optional<ResponseWriter>>();
+                }
+                catch(std::exception &e) {
+                    std::fprintf(stderr, "Failed to make a response writer: %s\n", e.what());
+                    this->close_connection(connection);
+                    return;
+                }
+            }
+            
+            Server::begin_response(&this->server, connection.ssl, *connection.response, *connection.writer);
+            connection.state = Connection::State::Write;
+            this->set_deadline(connection, ConnectionPhase::Write, this->server.timeouts.write);
+        }
+        
+        /** Drive the connection's state machine as far as it can go without blocking */
+        void advance(Connection &connection) noexcept {
+            std::size_t chunks_written = 0;
+            
+            while(true) {
+                ERR_clear_error();
+                
+                switch(connection.state) {
+                    case Connection::State::Handshake: {
+                        int result = SSL_accept(connection.ssl);
+                        if(result == 1) {
+                            this->server.handshake_completed(connection.ssl);
+                            connection.phase_start = this->server.metrics->record(LatencyPhase::Handshake, connection.phase_start);
+                            connection.state = Connection::State::ReadRequest;
+                            this->set_deadline(connection, ConnectionPhase::Request, this->server.timeouts.request);
+                            continue;
+                        }
+                        if(!this->wait_for_ssl(connection, result)) {
+                            this->close_connection(connection);
+                        }
+                        return;
+                    }
+                    
+                    case Connection::State::ReadRequest: {
+                        auto space = (sizeof(connection.request) - 1) - connection.request_size;
+                        
+                        // Request line is too long
+                        if(space == 0) {
+                            this->respond(connection, false);
+                            continue;
+                        }
+                        
+                        int result = SSL_read(connection.ssl, connection.request + connection.request_size, static_cast<int>(space));
+                        if(result > 0) {
+                            connection.request_size += result;
+                            auto size = connection.request_size;
+                            if(size > 2 && connection.request[size - 2] == '\r' && connection.request[size - 1] == '\n') {
+                                this->respond(connection, true);
+                            }
+                            continue;
+                        }
+                        
+                        if(!this->wait_for_ssl(connection, result)) {
+                            this->respond(connection, false);
+                            continue;
+                        }
+                        return;
+                    }
+                    
+                    case Connection::State::Respond:
+                    case Connection::State::Closed:
+                        return;
+                    
+                    case Connection::State::Write: {
+                        // Get the next chunk if we finished the last one
+                        if(connection.chunk.size == 0) {
+                            if(!(*connection.writer)->next_chunk(connection.chunk)) {
+                                if(connection.header_sent) {
+                                    this->server.metrics->record(LatencyPhase::BodyWrite, connection.phase_start);
+                                }
+                                
+                                // Leave out the close_notify so the client can tell the response was cut short
+                                if((*connection.writer)->has_failed()) {
+                                    SSL_set_quiet_shutdown(connection.ssl, 1);
+                                }
+                                this->close_connection(connection);
+                                return;
+                            }
+                            
+                            // Let everyone else have a turn if we've been at it for a while
+                            if(++chunks_written > CHUNKS_PER_TURN) {
+                                if(!this->watch(connection, EPOLLOUT)) {
+                                    this->close_connection(connection);
+                                }
+                                return;
+                            }
+                            continue;
+                        }
+                        
+                        auto &chunk = connection.chunk;
+                        auto result = chunk.file_handle >= 0 ? SSL_sendfile(connection.ssl, chunk.file_handle, static_cast<off_t>(chunk.file_offset), chunk.size, 0) : SSL_write(connection.ssl, chunk.data, static_cast<int>(chunk.size));
+                        if(result > 0) {
+                            chunk.consume(static_cast<std::size_t>(result));
+                            connection.bytes_sent += static_cast<std::uint64_t>(result);
+                            
+                            // The header is always in the first chunk
+                            if(chunk.size == 0 && !connection.header_sent) {
+                                connection.header_sent = true;
+                                connection.phase_start = this->server.metrics->record(LatencyPhase::HeaderWrite, connection.phase_start);
+                            }
+                            this->set_deadline(connection, ConnectionPhase::Write, this->server.timeouts.write);
+                            continue;
+                        }
+                        
+                        if(!this->wait_for_ssl(connection, static_cast<int>(result))) {
+                            #ifdef DEBUG
+                            std::fprintf(stderr, "Failed to send a response to a client\n");
+                            #endif
+                            this->close_connection(connection);
+                        }
+                        return;
+                    }
+                }
+            }
+        }
+        
+        void close_connection(Connection &connection) noexcept {
+            // Best effort - we don't wait for the client's close_notify
+            ERR_clear_error();
+            SSL_shutdown(connection.ssl);
+            SSL_free(connection.ssl);
+            this->deadlines.cancel(connection.deadline);
+            this->server.metrics->bytes_sent.fetch_add(connection.bytes_sent, std::memory_order_relaxed);
+            
+            // Everything that might use the client's memory goes before the client does, and the writer goes back for the next response
+            if(connection.writer) {
+                connection.writer->reset();
+                if(this->free_writers.size() < FREE_WRITER_COUNT) {
+                    this->free_writers.emplace_back(std::move(connection.writer));
+                }
+                connection.writer.reset();
+            }
+            connection.response.reset();
+            connection.uri.reset();
+            this->server.client_disconnected(connection.client); // closing the socket also removes it from epoll
+            
+            // Swap the last connection into its place, and set it aside until the batch is done (later events in it may still point to it)
+            auto index = connection.index;
+            connection.state = Connection::State::Closed;
+            this->closed_connections.emplace_back(std::move(this->connections[index]));
+            if(index + 1 < this->connections.size()) {
+                this->connections[index] = std::move(this->connections.back());
+                this->connections[index]->index = index;
+            }
+            this->connections.pop_back();
+            
+            // We have room again
+            this->set_listening(true);
+        }
+        
+        /** Reuse (or free) connections closed during the last batch of events */
+        void recycle_closed() noexcept {
+            for(auto &closed : this->closed_connections) {
+                closed->reset();
+                if(this->free_connections.size() < FREE_CONNECTION_COUNT) {
+                    this->free_connections.emplace_back(std::move(closed));
+                }
+            }
+            this->closed_connections.clear();
+        }
+    };
+    
+    EpollEngine::EpollEngine(Server &server, const std::vector<AcceptorShard *> &shards, unsigned int loop_count, unsigned long connection_limit) {
+        // Only pin loops that have a shard to themselves
+        bool own_shards = shards.size() == loop_count;
+        
+        for(unsigned int i = 0; i < loop_count; i++) {
+            auto &shard = *shards[i % shards.size()];
+            this->loops.emplace_back(std::make_unique<Loop>(*this, server, shard, connection_limit, own_shards ? shard.cpu : -1));
+        }
+    }
+    
+    EpollEngine::~EpollEngine() = default;
+    
+    void EpollEngine::run() {
+        // The calling thread runs the first loop
+        std::vector<std::thread> threads;
+        for(std::size_t i = 1; i < this->loops.size(); i++) {
+            threads.emplace_back(&Loop::run, this->loops[i].get());
+        }
+        
+        this->loops[0]->run();
+        
+        for(auto &thread : threads) {
+            thread.join();
+        }
+    }
+    
+    void EpollEngine::stop() noexcept {
+        this->stopping = true;
+        for(auto &loop : this->loops) {
+            loop->wake();
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef MOUSYGEM__EPOLL_ENGINE_HPP
+#define MOUSYGEM__EPOLL_ENGINE_HPP
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace Mousygem {
+    class Server;
+    struct AcceptorShard;
+    
+    /**
+     * Event-driven connection engine.
+     *
+     * Each event loop has its own epoll instance which the listening socket is registered with (using EPOLLEXCLUSIVE so only one loop wakes
+     * up per connection). Connections are non-blocking, and the TLS handshake, request read, and response write are driven as a state
+     * machine, so a slow client only costs memory rather than a thread.
+     */
+    class EpollEngine {
+    public:
+        /**
+         * Set up the event loops
+         * @param server           server to serve
+         * @param shards           shards with non-blocking listening sockets; loops are assigned to them round-robin
+         * @param loop_count       number of event loops (threads)
+         * @param connection_limit maximum number of connections per event loop
+         * @throws std::runtime_error if epoll could not be set up
+         */
+        EpollEngine(Server &server, const std::vector<AcceptorShard *> &shards, unsigned int loop_count, unsigned long connection_limit);
+        
+        /**
+         * Run the event loops. This blocks until stop() is called and all clients have disconnected.
+         */
+        void run();
+        
+        /**
+         * Stop accepting clients. This function is thread-safe.
+         */
+        void stop() noexcept;
+        
+        ~EpollEngine();
+        
+        EpollEngine(const EpollEngine &) = delete;
+        EpollEngine &operator =(const EpollEngine &) = delete;
+    
+    private:
+        class Loop;
+        struct Connection;
+        
+        /** Event loops */
+        std::vector<std::unique_ptr<Loop>> loops;
+        
+        /** Are we stopping? */
+        std::atomic<bool> stopping = false;
+    };
+}
+
+#endif
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include "metrics.hpp"
+
+namespace Mousygem {
+    std::size_t LatencyHistogram::bucket_of(std::uint64_t nanoseconds) noexcept {
+        if(nanoseconds < 16) {
+            return static_cast<std::size_t>(nanoseconds);
+        }
+        
+        // The top bit picks the power of two, and the three bits after it pick the bucket within it
+        auto exponent = static_cast<std::size_t>(63 - __builtin_clzll(nanoseconds));
+        if(exponent >= 40) {
+            return BUCKET_COUNT - 1;
+        }
+        auto sub_bucket = static_cast<std::size_t>((nanoseconds >> (exponent - 3)) & 7);
+        return 16 + (exponent - 4) * 8 + sub_bucket;
+    }
+    
+    void LatencyHistogram::record(std::chrono::nanoseconds duration) noexcept {
+        auto nanoseconds = static_cast<std::uint64_t>(std::max<std::chrono::nanoseconds::rep>(duration.count(), 0));
+        this->buckets[bucket_of(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        this->count.fetch_add(1, std::memory_order_relaxed);
+        this->total.fetch_add(nanoseconds, std::memory_order_relaxed);
+        
+        auto max = this->max.load(std::memory_order_relaxed);
+        while(nanoseconds > max && !this->max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {}
+    }
+    
+    LatencyStatistics LatencyHistogram::snapshot() const {
+        LatencyStatistics statistics;
+        statistics.count = this->count.load(std::memory_order_relaxed);
+        statistics.total = std::chrono::nanoseconds(this->total.load(std::memory_order_relaxed));
+        statistics.max = std::chrono::nanoseconds(this->max.load(std::memory_order_relaxed));
+        statistics.buckets.reserve(BUCKET_COUNT);
+        for(auto &bucket : this->buckets) {
+            statistics.buckets.emplace_back(bucket.load(std::memory_order_relaxed));
+        }
+        return statistics;
+    }
+    
+    std::chrono::nanoseconds LatencyStatistics::get_bucket_upper_bound(std::size_t index) noexcept {
+        if(index < 16) {
+            return std::chrono::nanoseconds(index);
+        }
+        if(index >= LatencyHistogram::BUCKET_COUNT - 1) {
+            return std::chrono::nanoseconds::max();
+        }
+        
+        auto exponent = 4 + (index - 16) / 8;
+        auto sub_bucket = (index - 16) % 8;
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(((9 + sub_bucket) << (exponent - 3)) - 1));
+    }
+    
+    std::chrono::nanoseconds LatencyStatistics::get_percentile(double percentile) const noexcept {
+        if(this->count == 0) {
+            return std::chrono::nanoseconds(0);
+        }
+        
+        // Find the bucket holding the sample at this rank
+        auto rank = static_cast<std::uint64_t>(percentile / 100.0 * static_cast<double>(this->count) + 0.5);
+        rank = std::max<std::uint64_t>(rank, 1);
+        
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < this->buckets.size(); i++) {
+            seen += this->buckets[i];
+            if(seen >= rank) {
+                return std::min(get_bucket_upper_bound(i), this->max);
+            }
+        }
+        return this->max;
+    }
+    
+    ServerStatistics ServerMetrics::snapshot() const {
+        ServerStatistics statistics;
+        statistics.connections_accepted = this->connections_accepted.load(std::memory_order_relaxed);
+        statistics.bytes_sent = this->bytes_sent.load(std::memory_order_relaxed);
+        for(std::size_t i = 0; i < this->responses.size(); i++) {
+            statistics.responses[i] = this->responses[i].load(std::memory_order_relaxed);
+        }
+        
+        statistics.accept_wait = this->latency[static_cast<std::size_t>(LatencyPhase::AcceptWait)].snapshot();
+        statistics.handshake = this->latency[static_cast<std::size_t>(LatencyPhase::Handshake)].snapshot();
+        statistics.request_read = this->latency[static_cast<std::size_t>(LatencyPhase::RequestRead)].snapshot();
+        statistics.respond = this->latency[static_cast<std::size_t>(LatencyPhase::Respond)].snapshot();
+        statistics.header_write = this->latency[static_cast<std::size_t>(LatencyPhase::HeaderWrite)].snapshot();
+        statistics.body_write = this->latency[static_cast<std::size_t>(LatencyPhase::BodyWrite)].snapshot();
+        return statistics;
+    }
+    
+    // Append printf-formatted text to a string
+    template<typename... Args> static void append(std::string &output, const char *format, Args... args) {
+        char line[256];
+        auto size = std::snprintf(line, sizeof(line), format, args...);
+        if(size > 0) {
+            output.append(line, std::min(static_cast<std::size_t>(size), sizeof(line) - 1));
+        }
+    }
+    
+    static void append_counter(std::string &output, const char *name, const char *help, const char *type, std::uint64_t value) {
+        append(output, "# HELP %s %s\n# TYPE %s %s\n%s %" PRIu64 "\n", name, help, name, type, name, value);
+    }
+    
+    std::string format_prometheus_metrics(const ServerStatistics &server, const TimeoutStatistics &timeouts, const SessionStatistics &sessions, const ResponseCacheStatistics &response_cache, const RateLimitStatistics &rate_limits) {
+        std::string output;
+        
+        append_counter(output, "mousygem_connections_accepted_total", "Clients accepted.", "counter", server.connections_accepted);
+        append_counter(output, "mousygem_connections_active", "Clients currently connected.", "gauge", server.active_connections);
+        append_counter(output, "mousygem_sent_bytes_total", "Bytes of response headers and data sent.", "counter", server.bytes_sent);
+        
+        output += "# HELP mousygem_responses_total Responses sent, by response code.\n# TYPE mousygem_responses_total counter\n";
+        for(std::size_t code = 0; code < server.responses.size(); code++) {
+            if(server.responses[code] > 0) {
+                append(output, "mousygem_responses_total{code=\"%zu\"} %" PRIu64 "\n", code, server.responses[code]);
+            }
+        }
+        
+        // Buckets are reported at each power of two from about a microsecond to about 9 minutes
+        output += "# HELP mousygem_phase_duration_seconds Time taken by each phase of serving a client.\n# TYPE mousygem_phase_duration_seconds histogram\n";
+        const std::pair<const char *, const LatencyStatistics *> phases[] = {
+            {"accept_wait", &server.accept_wait},
+            {"handshake", &server.handshake},
+            {"request_read", &server.request_read},
+            {"respond", &server.respond},
+            {"header_write", &server.header_write},
+            {"body_write", &server.body_write}
+        };
+        for(auto &[phase, latency] : phases) {
+            std::uint64_t cumulative = 0;
+            std::size_t bucket = 0;
+            for(std::size_t exponent = 10; exponent < 40; exponent++) {
+                // Everything up to the first bucket of this power of two
+                auto end = 16 + (exponent - 4) * 8;
+                for(; bucket < end && bucket < latency->buckets.size(); bucket++) {
+                    cumulative += latency->buckets[bucket];
+                }
+                append(output, "mousygem_phase_duration_seconds_bucket{phase=\"%s\",le=\"%.9g\"} %" PRIu64 "\n", phase, static_cast<double>(std::uint64_t(1) << exponent) / 1e9, cumulative);
+            }
+            append(output, "mousygem_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", phase, latency->count);
+            append(output, "mousygem_phase_duration_seconds_sum{phase=\"%s\"} %.9f\n", phase, static_cast<double>(latency->total.count()) / 1e9);
+            append(output, "mousygem_phase_duration_seconds_count{phase=\"%s\"} %" PRIu64 "\n", phase, latency->count);
+        }
+        
+        output += "# HELP mousygem_timeouts_total Clients disconnected for missing a deadline, by phase.\n# TYPE mousygem_timeouts_total counter\n";
+        append(output, "mousygem_timeouts_total{phase=\"handshake\"} %" PRIu64 "\n", timeouts.handshake_timeouts);
+        append(output, "mousygem_timeouts_total{phase=\"request\"} %" PRIu64 "\n", timeouts.request_timeouts);
+        append(output, "mousygem_timeouts_total{phase=\"write\"} %" PRIu64 "\n", timeouts.write_timeouts);
+        
+        output += "# HELP mousygem_handshakes_total TLS handshakes, by whether they resumed a session.\n# TYPE mousygem_handshakes_total counter\n";
+        append(output, "mousygem_handshakes_total{resumed=\"true\"} %" PRIu64 "\n", sessions.resumed_handshakes);
+        append(output, "mousygem_handshakes_total{resumed=\"false\"} %" PRIu64 "\n", sessions.full_handshakes);
+        
+        append_counter(output, "mousygem_response_cache_hits_total", "Requests answered from the response cache.", "counter", response_cache.hits);
+        append_counter(output, "mousygem_response_cache_misses_total", "Requests that had to call respond().", "counter", response_cache.misses);
+        
+        output += "# HELP mousygem_slowed_down_total Clients answered with 44 (slow down), by which limit they went over.\n# TYPE mousygem_slowed_down_total counter\n";
+        append(output, "mousygem_slowed_down_total{limit=\"requests\"} %" PRIu64 "\n", rate_limits.rate_limited);
+        append(output, "mousygem_slowed_down_total{limit=\"connections\"} %" PRIu64 "\n", rate_limits.connection_limited);
+        
+        return output;
+    }
+}
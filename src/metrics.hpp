@@ -0,0 +1,94 @@
+#ifndef MOUSYGEM__METRICS_HPP
+#define MOUSYGEM__METRICS_HPP
+
+#include <mousygem/statistics.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Mousygem {
+    /**
+     * Lock-free latency histogram with log-linear buckets (see LatencyStatistics).
+     */
+    class LatencyHistogram {
+    public:
+        /** Number of buckets: one for each value under 16 ns, then 8 for each power of two up to 2^40 ns (about 18 minutes) */
+        static constexpr const std::size_t BUCKET_COUNT = 16 + (40 - 4) * 8;
+        
+        /**
+         * Count a sample. This function is thread-safe.
+         * @param duration sample
+         */
+        void record(std::chrono::nanoseconds duration) noexcept;
+        
+        /**
+         * Copy the histogram. This function is thread-safe, though samples counted while copying may only be partly included.
+         * @return statistics
+         */
+        LatencyStatistics snapshot() const;
+        
+        /**
+         * Find the bucket for a value
+         * @param nanoseconds value
+         * @return index of the bucket
+         */
+        static std::size_t bucket_of(std::uint64_t nanoseconds) noexcept;
+    
+    private:
+        std::array<std::atomic<std::uint64_t>, BUCKET_COUNT> buckets = {};
+        std::atomic<std::uint64_t> count = 0;
+        std::atomic<std::uint64_t> total = 0;
+        std::atomic<std::uint64_t> max = 0;
+    };
+    
+    /**
+     * Phases of serving a client that are timed
+     */
+    enum class LatencyPhase : std::size_t {
+        AcceptWait,
+        Handshake,
+        RequestRead,
+        Respond,
+        HeaderWrite,
+        BodyWrite
+    };
+    
+    /**
+     * Counters shared by the connection engines
+     */
+    struct ServerMetrics {
+        using Clock = std::chrono::steady_clock;
+        
+        std::array<LatencyHistogram, 6> latency;
+        std::atomic<std::uint64_t> connections_accepted = 0;
+        std::atomic<std::uint64_t> bytes_sent = 0;
+        std::array<std::atomic<std::uint64_t>, 100> responses = {};
+        
+        /** Time a phase that started at start and just ended, returning now */
+        Clock::time_point record(LatencyPhase phase, Clock::time_point start) noexcept {
+            auto now = Clock::now();
+            this->latency[static_cast<std::size_t>(phase)].record(now - start);
+            return now;
+        }
+        
+        /** Count a response that's about to be sent */
+        void count_response(int code) noexcept {
+            if(code >= 0 && code < static_cast<int>(this->responses.size())) {
+                this->responses[static_cast<std::size_t>(code)].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        
+        /** Copy everything but the connection counts */
+        ServerStatistics snapshot() const;
+    };
+    
+    /**
+     * Format statistics in the Prometheus text exposition format
+     * @return text
+     */
+    std::string format_prometheus_metrics(const ServerStatistics &server, const TimeoutStatistics &timeouts, const SessionStatistics &sessions, const ResponseCacheStatistics &response_cache, const RateLimitStatistics &rate_limits);
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+#include "rate_limiter.hpp"
+#include "socket.hpp"
+
+namespace Mousygem {
+    RateLimiter::RateLimiter(double requests_per_second, unsigned int burst, unsigned int max_connections, std::size_t table_size) :
+        tokens_per_ms(requests_per_second * TOKEN / 1000.0), capacity(std::min(burst, MAX_BURST) * TOKEN), max_connections(max_connections), start(Clock::now()) {
+        // Round each shard up to a power of two so slots can be found with a mask
+        std::size_t shard_size = PROBE_LENGTH;
+        while(shard_size * SHARD_COUNT < table_size) {
+            shard_size *= 2;
+        }
+        for(auto &shard : this->shards) {
+            shard.entries = std::make_unique<RateLimitEntry[]>(shard_size);
+            shard.mask = shard_size - 1;
+        }
+        
+        std::random_device random;
+        this->hash_key = (static_cast<std::uint64_t>(random()) << 32) | random();
+    }
+    
+    std::uint64_t RateLimiter::hash(const SocketAddress &address) const noexcept {
+        std::uint64_t value;
+        switch(address.ss.ss_family) {
+            case AF_INET: {
+                value = reinterpret_cast<const sockaddr_in *>(&address.ss)->sin_addr.s_addr;
+                break;
+            }
+            case AF_INET6: {
+                auto &address6 = reinterpret_cast<const sockaddr_in6 *>(&address.ss)->sin6_addr;
+                
+                // IPv4 clients of a dual-stack socket are still limited individually
+                if(IN6_IS_ADDR_V4MAPPED(&address6)) {
+                    std::uint32_t address4;
+                    std::memcpy(&address4, address6.s6_addr + 12, sizeof(address4));
+                    value = address4;
+                }
+                else {
+                    std::memcpy(&value, address6.s6_addr, sizeof(value));
+                    value = ~value; // keep /64s from matching IPv4 addresses
+                }
+                break;
+            }
+            default:
+                return 0;
+        }
+        
+        // splitmix64's finalizer
+        value ^= this->hash_key;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+        return value ^ (value >> 31);
+    }
+    
+    std::uint64_t RateLimiter::now_ms() const noexcept {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - this->start).count());
+    }
+    
+    bool RateLimiter::connect(const SocketAddress &address, RateLimitEntry *&entry) noexcept {
+        entry = nullptr;
+        
+        auto hash = this->hash(address);
+        if(hash == 0) {
+            return true;
+        }
+        
+        // The top 48 bits identify the address within its slots; 0 means a free slot
+        auto tag = std::max<std::uint64_t>(hash >> 16, 1);
+        auto &shard = this->shards[hash % SHARD_COUNT];
+        auto first_slot = hash / SHARD_COUNT;
+        
+        // Retry if another thread takes the slot we wanted first
+        for(int attempt = 0; attempt < 4; attempt++) {
+            RateLimitEntry *victim = nullptr;
+            std::uint64_t victim_owner = 0;
+            std::uint64_t victim_updated = UINT64_MAX;
+            bool retry = false;
+            
+            for(std::size_t i = 0; i < PROBE_LENGTH; i++) {
+                auto &slot = shard.entries[(first_slot + i) & shard.mask];
+                auto owner = slot.owner.load(std::memory_order_acquire);
+                
+                // Already tracked; count the connection if there's room
+                bool tracked = (owner >> 16) == tag;
+                while((owner >> 16) == tag) {
+                    auto connections = owner & CONNECTIONS_MASK;
+                    if((this->max_connections > 0 && connections >= this->max_connections) || connections == CONNECTIONS_MASK) {
+                        this->connection_limited.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    if(slot.owner.compare_exchange_weak(owner, owner + 1, std::memory_order_acq_rel)) {
+                        entry = &slot;
+                        return true;
+                    }
+                }
+                
+                // It was given to another address in the meantime, so look again
+                if(tracked) {
+                    retry = true;
+                    break;
+                }
+                
+                // Addresses with open connections stay
+                if((owner & CONNECTIONS_MASK) != 0) {
+                    continue;
+                }
+                
+                // Prefer a free slot, then whichever idle address was seen least recently
+                auto updated = owner == 0 ? 0 : (slot.bucket.load(std::memory_order_relaxed) >> 24) + 1;
+                if(updated < victim_updated) {
+                    victim = &slot;
+                    victim_owner = owner;
+                    victim_updated = updated;
+                }
+            }
+            
+            if(retry) {
+                continue;
+            }
+            if(!victim) {
+                break;
+            }
+            
+            // Take it with a full bucket, unless someone beat us to it
+            if(victim->owner.compare_exchange_strong(victim_owner, (tag << 16) | 1, std::memory_order_acq_rel)) {
+                victim->bucket.store((this->now_ms() << 24) | this->capacity, std::memory_order_relaxed);
+                entry = victim;
+                return true;
+            }
+        }
+        
+        this->untracked.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    
+    void RateLimiter::disconnect(RateLimitEntry *entry) noexcept {
+        if(entry) {
+            entry->owner.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+    
+    std::optional<unsigned int> RateLimiter::take_request(RateLimitEntry *entry) noexcept {
+        if(!entry || this->tokens_per_ms <= 0.0) {
+            return std::nullopt;
+        }
+        
+        auto now = this->now_ms();
+        auto bucket = entry->bucket.load(std::memory_order_relaxed);
+        while(true) {
+            auto updated = bucket >> 24;
+            auto tokens = bucket & TOKENS_MASK;
+            
+            // Refill for the time since it was last updated (checking the time first so this can't overflow)
+            auto elapsed = now > updated ? now - updated : 0;
+            if(static_cast<double>(elapsed) * this->tokens_per_ms >= static_cast<double>(this->capacity)) {
+                tokens = this->capacity;
+            }
+            else {
+                tokens = std::min(this->capacity, tokens + static_cast<std::uint64_t>(static_cast<double>(elapsed) * this->tokens_per_ms));
+            }
+            
+            if(tokens < TOKEN) {
+                this->rate_limited.fetch_add(1, std::memory_order_relaxed);
+                auto wait_ms = static_cast<double>(TOKEN - tokens) / this->tokens_per_ms;
+                return std::max(1U, static_cast<unsigned int>(std::ceil(wait_ms / 1000.0)));
+            }
+            
+            if(entry->bucket.compare_exchange_weak(bucket, (std::max(now, updated) << 24) | (tokens - TOKEN), std::memory_order_relaxed)) {
+                return std::nullopt;
+            }
+        }
+    }
+    
+    RateLimitStatistics RateLimiter::get_statistics() const noexcept {
+        RateLimitStatistics statistics;
+        statistics.rate_limited = this->rate_limited;
+        statistics.connection_limited = this->connection_limited;
+        statistics.untracked = this->untracked;
+        return statistics;
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef MOUSYGEM__RATE_LIMITER_HPP
+#define MOUSYGEM__RATE_LIMITER_HPP
+
+#include <mousygem/statistics.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+namespace Mousygem {
+    struct SocketAddress;
+    
+    /**
+     * An address tracked by a RateLimiter
+     */
+    struct RateLimitEntry {
+        /** Hash of the address in the top 48 bits (0 if the entry is free), and its number of open connections in the bottom 16 bits */
+        std::atomic<std::uint64_t> owner = 0;
+        
+        /** When the bucket was last updated in ms since the limiter was created in the top 40 bits, and its tokens in 1/1024ths in the bottom 24 bits */
+        std::atomic<std::uint64_t> bucket = 0;
+    };
+    
+    /**
+     * Per-address request rate and connection limits.
+     *
+     * Addresses are keyed by their binary form: IPv4 addresses individually, and IPv6 addresses by their /64 prefix (since a single host is
+     * usually given a whole /64). Each address gets a token bucket for requests and a count of open connections, kept together in one entry
+     * of a fixed-size table. The table is split into shards, each an open-addressed array probed a few slots at a time, and entries are only
+     * updated with compare-and-swap, so no locks are taken.
+     *
+     * Entries with open connections are never evicted. When every slot an address could go in is taken by an address with open
+     * connections, the new address isn't tracked (and isn't limited) until room frees up. Racing threads can briefly let an address go a
+     * little over its limits, which is fine for slowing down crawlers.
+     */
+    class RateLimiter {
+    public:
+        /** Largest burst a bucket can hold */
+        static const constexpr unsigned int MAX_BURST = 16383;
+        
+        /**
+         * Create a limiter
+         * @param requests_per_second requests each address can make per second on average, or 0 for no limit
+         * @param burst               requests each address can make at once (at most MAX_BURST)
+         * @param max_connections     connections each address can have open at once, or 0 for no limit
+         * @param table_size          number of addresses that can be tracked at once
+         */
+        RateLimiter(double requests_per_second, unsigned int burst, unsigned int max_connections, std::size_t table_size);
+        
+        /**
+         * Count a new connection from an address. This function is thread-safe.
+         * @param address address of the client
+         * @param entry   set to the address's entry, or nullptr if it couldn't be tracked or is over its limit
+         * @return false if the address already has as many connections open as it's allowed
+         */
+        bool connect(const SocketAddress &address, RateLimitEntry *&entry) noexcept;
+        
+        /**
+         * Count a connection closing. This function is thread-safe.
+         * @param entry entry set by connect() (may be nullptr)
+         */
+        void disconnect(RateLimitEntry *entry) noexcept;
+        
+        /**
+         * Take a token for a request. This function is thread-safe.
+         * @param entry entry set by connect() (may be nullptr)
+         * @return nullopt if the request is allowed, or else how many seconds to wait until it would be
+         */
+        std::optional<unsigned int> take_request(RateLimitEntry *entry) noexcept;
+        
+        /**
+         * Get statistics. This function is thread-safe.
+         * @return statistics
+         */
+        RateLimitStatistics get_statistics() const noexcept;
+        
+        RateLimiter(const RateLimiter &) = delete;
+        RateLimiter &operator =(const RateLimiter &) = delete;
+    
+    private:
+        using Clock = std::chrono::steady_clock;
+        
+        static const constexpr std::size_t SHARD_COUNT = 16;
+        static const constexpr std::size_t PROBE_LENGTH = 8;
+        static const constexpr std::uint64_t CONNECTIONS_MASK = 0xFFFF;
+        static const constexpr std::uint64_t TOKENS_MASK = 0xFFFFFF;
+        static const constexpr std::uint64_t TOKEN = 1024;
+        
+        struct alignas(64) Shard {
+            std::unique_ptr<RateLimitEntry[]> entries;
+            std::size_t mask = 0;
+        };
+        
+        std::array<Shard, SHARD_COUNT> shards;
+        
+        /** Tokens (in 1/1024ths) added to each bucket per ms */
+        double tokens_per_ms;
+        
+        /** Bucket size (in 1/1024ths of a token) */
+        std::uint64_t capacity;
+        
+        unsigned int max_connections;
+        
+        /** Random key for hashing addresses, so which addresses share slots can't be predicted */
+        std::uint64_t hash_key;
+        
+        Clock::time_point start;
+        
+        std::atomic<std::uint64_t> rate_limited = 0;
+        std::atomic<std::uint64_t> connection_limited = 0;
+        std::atomic<std::uint64_t> untracked = 0;
+        
+        /** Hash an address (0 if it's not an IP address) */
+        std::uint64_t hash(const SocketAddress &address) const noexcept;
+        
+        /** Get the current time as stored in buckets */
+        std::uint64_t now_ms() const noexcept;
+    };
+}
+
+#endif
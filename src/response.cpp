@@ -0,0 +1,106 @@
+#include <mousygem/response.hpp>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "socket.hpp"
+
+namespace Mousygem {
+    ResponseFile::ResponseFile(const std::filesystem::path &path) {
+        this->handle = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(this->handle < 0) {
+            throw except_latest_error("failed to open " + path.string());
+        }
+        
+        struct stat file_stat;
+        if(fstat(this->handle, &file_stat) < 0) {
+            auto error = except_latest_error("failed to stat " + path.string());
+            close(this->handle);
+            throw error;
+        }
+        
+        this->size = static_cast<std::uint64_t>(file_stat.st_size);
+    }
+    
+    ResponseFile::ResponseFile(ResponseFile &&other) noexcept : handle(other.handle), size(other.size) {
+        other.handle = -1; // set to -1 so the destructor knows to not close it
+    }
+    
+    ResponseFile &ResponseFile::operator =(ResponseFile &&other) noexcept {
+        if(this != &other) {
+            if(this->handle >= 0) {
+                close(this->handle);
+            }
+            this->handle = other.handle;
+            this->size = other.size;
+            other.handle = -1;
+        }
+        return *this;
+    }
+    
+    ResponseFile::~ResponseFile() noexcept {
+        if(this->handle >= 0) {
+            close(this->handle);
+        }
+    }
+    
+    MappedFile::MappedFile(const std::filesystem::path &path, std::uint64_t offset, std::size_t length) {
+        auto handle = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(handle < 0) {
+            throw except_latest_error("failed to open " + path.string());
+        }
+        
+        struct stat file_stat;
+        if(fstat(handle, &file_stat) < 0) {
+            auto error = except_latest_error("failed to stat " + path.string());
+            close(handle);
+            throw error;
+        }
+        
+        auto file_size = static_cast<std::uint64_t>(file_stat.st_size);
+        if(offset > file_size || (length != SIZE_MAX && length > file_size - offset)) {
+            close(handle);
+            throw std::runtime_error("region is outside of " + path.string());
+        }
+        
+        auto region_size = length == SIZE_MAX ? file_size - offset : length;
+        if(region_size > SIZE_MAX - static_cast<std::size_t>(sysconf(_SC_PAGESIZE))) {
+            close(handle);
+            throw std::runtime_error(path.string() + " is too large to map");
+        }
+        this->region_size = static_cast<std::size_t>(region_size);
+        
+        // Nothing to map (mmap fails with a length of 0)
+        if(this->region_size == 0) {
+            close(handle);
+            return;
+        }
+        
+        // mmap offsets have to be page aligned
+        auto page_size = static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+        auto mapping_offset = offset - offset % page_size;
+        this->mapping_size = static_cast<std::size_t>(offset - mapping_offset) + this->region_size;
+        
+        this->mapping = mmap(nullptr, this->mapping_size, PROT_READ, MAP_SHARED, handle, static_cast<off_t>(mapping_offset));
+        auto mmap_error = errno;
+        close(handle); // the mapping keeps the file open
+        
+        if(this->mapping == MAP_FAILED) {
+            this->mapping = nullptr;
+            errno = mmap_error;
+            throw except_latest_error("failed to map " + path.string());
+        }
+        
+        madvise(this->mapping, this->mapping_size, MADV_SEQUENTIAL);
+        this->region = reinterpret_cast<const std::byte *>(this->mapping) + (offset - mapping_offset);
+    }
+    
+    MappedFile::~MappedFile() noexcept {
+        if(this->mapping) {
+            munmap(this->mapping, this->mapping_size);
+        }
+    }
+}
@@ -0,0 +1,269 @@
+#include <mousygem/client.hpp>
+#include <mousygem/uri.hpp>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "response_cache.hpp"
+#include "response_writer.hpp"
+
+namespace Mousygem {
+    ResponseCache::ResponseCache(std::size_t max_bytes) : max_shard_bytes(max_bytes / SHARD_COUNT) {}
+    
+    bool ResponseCache::Key::append(std::string_view string) noexcept {
+        if(string.size() > CAPACITY - this->size) {
+            return false;
+        }
+        std::memcpy(this->data + this->size, string.data(), string.size());
+        this->size += string.size();
+        return true;
+    }
+    
+    bool ResponseCache::base_key(const URI &uri, Key &key) noexcept {
+        key.size = 0;
+        return key.append(uri.raw_hostname()) && key.append(std::string_view("\0", 1)) && key.append(uri.raw_path());
+    }
+    
+    bool ResponseCache::full_key(const Key &base_key, Response::CacheKey policy, const URI &uri, const Client &client, Key &key) noexcept {
+        key.size = 0;
+        if(!key.append(base_key.view())) {
+            return false;
+        }
+        
+        if(policy == Response::CacheKey::PathAndInput || policy == Response::CacheKey::PathInputAndCertificate) {
+            auto input = uri.raw_input();
+            if(!key.append(std::string_view("\0", 1)) || (input.has_value() && !(key.append("?") && key.append(*input)))) {
+                return false;
+            }
+        }
+        
+        if(policy == Response::CacheKey::PathInputAndCertificate) {
+            auto &fingerprint = client.get_certificate_fingerprint();
+            if(!key.append(std::string_view("\0", 1))) {
+                return false;
+            }
+            if(fingerprint.has_value() && !(key.append("!") && key.append(std::string_view(reinterpret_cast<const char *>(fingerprint->data()), fingerprint->size())))) {
+                return false;
+            }
+        }
+        
+        return true;
+    }
+    
+    ResponseCache::Shard &ResponseCache::shard_for(std::size_t base_hash) noexcept {
+        return this->shards[base_hash % SHARD_COUNT];
+    }
+    
+    std::optional<Response> ResponseCache::find(const URI &uri, const Client &client) {
+        Key base;
+        if(!base_key(uri, base)) {
+            this->misses++;
+            return std::nullopt;
+        }
+        auto base_hash = hash(base);
+        auto &shard = this->shard_for(base_hash);
+        auto now = Clock::now();
+        
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        
+        auto policy = shard.policies.find(base_hash);
+        if(policy == shard.policies.end() || policy->second.base != base.view() || policy->second.conflicted) {
+            this->misses++;
+            return std::nullopt;
+        }
+        
+        Key key;
+        if(!full_key(base, policy->second.key, uri, client, key)) {
+            this->misses++;
+            return std::nullopt;
+        }
+        auto found = shard.entries.find(hash(key));
+        if(found == shard.entries.end() || found->second.key != key.view() || found->second.expires <= now) {
+            this->misses++;
+            return std::nullopt;
+        }
+        
+        auto &entry = found->second;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry.lru_position);
+        
+        Response response(entry.code, entry.meta);
+        response.formatted_header = entry.header;
+        if(entry.data.has_value()) {
+            std::visit([&response](const auto &data) {
+                response.set_data(data);
+            }, *entry.data);
+        }
+        
+        this->hits++;
+        return response;
+    }
+    
+    void ResponseCache::store(const URI &uri, const Client &client, Response &response) {
+        auto ttl = response.get_cache_ttl();
+        if(ttl.count() <= 0) {
+            return;
+        }
+        
+        // Only in-memory data can be shared
+        Entry entry;
+        if(response.has_data()) {
+            auto &data = *response.data;
+            if(auto *vector = std::get_if<std::vector<std::byte>>(&data)) {
+                auto shared = std::make_shared<const std::vector<std::byte>>(std::move(*vector));
+                response.set_data(shared);
+                entry.data = std::move(shared);
+            }
+            else if(auto *vector = std::get_if<std::pmr::vector<std::byte>>(&data)) {
+                // Its memory goes away with the connection, so the cache needs its own copy
+                auto shared = std::make_shared<const std::vector<std::byte>>(vector->begin(), vector->end());
+                response.set_data(shared);
+                entry.data = std::move(shared);
+            }
+            else if(auto *shared = std::get_if<std::shared_ptr<const std::vector<std::byte>>>(&data)) {
+                entry.data = *shared;
+            }
+            else if(auto *mapped = std::get_if<std::shared_ptr<const MappedFile>>(&data)) {
+                entry.data = *mapped;
+            }
+            else {
+                return;
+            }
+        }
+        
+        char header[1025];
+        auto header_size = ResponseWriter::format_header(response, header);
+        if(header_size == 0) {
+            return;
+        }
+        
+        Key base;
+        Key key;
+        auto policy_key = response.get_cache_key();
+        if(!base_key(uri, base) || !full_key(base, policy_key, uri, client, key)) {
+            return;
+        }
+        auto base_hash = hash(base);
+        auto key_hash = hash(key);
+        
+        auto now = Clock::now();
+        entry.code = response.get_code();
+        entry.meta = response.get_meta();
+        entry.header = std::make_shared<const std::string>(header, header_size);
+        entry.expires = now + ttl;
+        entry.key = std::string(key.view());
+        entry.size = key.size + base.size + header_size + entry.meta.size();
+        
+        // Mapped files are backed by the page cache, so only count heap data
+        if(entry.data.has_value()) {
+            if(auto *shared = std::get_if<std::shared_ptr<const std::vector<std::byte>>>(&*entry.data)) {
+                entry.size += (*shared)->size();
+            }
+        }
+        
+        // The sender uses the same header
+        response.formatted_header = entry.header;
+        
+        auto &shard = this->shard_for(base_hash);
+        if(entry.size > this->max_shard_bytes) {
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        
+        // A path can only have one policy at a time, or lookups could find a response meant for other clients
+        auto &policy = shard.policies[base_hash];
+        if(policy.base != base.view() || policy.expires <= now) {
+            policy.base = std::string(base.view());
+            policy.key = policy_key;
+            policy.expires = Clock::time_point();
+            policy.conflicted = false;
+        }
+        else if(policy.conflicted) {
+            return;
+        }
+        else if(policy.key != policy_key) {
+            policy.conflicted = true;
+            return;
+        }
+        policy.expires = std::max(policy.expires, entry.expires);
+        
+        // Replace the entry with the same hash (usually the same key)
+        auto existing = shard.entries.find(key_hash);
+        if(existing != shard.entries.end()) {
+            erase(shard, existing);
+        }
+        
+        this->make_room(shard, entry.size, now);
+        
+        shard.lru.push_front(key_hash);
+        entry.lru_position = shard.lru.begin();
+        shard.bytes += entry.size;
+        shard.entries.emplace(key_hash, std::move(entry));
+        this->stores++;
+    }
+    
+    void ResponseCache::erase(Shard &shard, std::unordered_map<std::size_t, Entry>::iterator entry) noexcept {
+        shard.bytes -= entry->second.size;
+        shard.lru.erase(entry->second.lru_position);
+        shard.entries.erase(entry);
+    }
+    
+    void ResponseCache::make_room(Shard &shard, std::size_t size, Clock::time_point now) {
+        if(shard.bytes + size <= this->max_shard_bytes) {
+            return;
+        }
+        
+        // Drop expired responses first
+        for(auto i = shard.entries.begin(); i != shard.entries.end();) {
+            if(i->second.expires <= now) {
+                auto expired = i++;
+                erase(shard, expired);
+                this->evictions++;
+            }
+            else {
+                i++;
+            }
+        }
+        
+        for(auto i = shard.policies.begin(); i != shard.policies.end();) {
+            if(i->second.expires <= now) {
+                i = shard.policies.erase(i);
+            }
+            else {
+                i++;
+            }
+        }
+        
+        // Then the least recently used ones
+        while(!shard.lru.empty() && shard.bytes + size > this->max_shard_bytes) {
+            erase(shard, shard.entries.find(shard.lru.back()));
+            this->evictions++;
+        }
+    }
+    
+    void ResponseCache::clear() noexcept {
+        for(auto &shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.entries.clear();
+            shard.lru.clear();
+            shard.policies.clear();
+            shard.bytes = 0;
+        }
+    }
+    
+    ResponseCacheStatistics ResponseCache::get_statistics() const {
+        ResponseCacheStatistics statistics;
+        statistics.hits = this->hits;
+        statistics.misses = this->misses;
+        statistics.stores = this->stores;
+        statistics.evictions = this->evictions;
+        
+        for(auto &shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            statistics.entries += shard.entries.size();
+            statistics.bytes += shard.bytes;
+        }
+        
+        return statistics;
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef MOUSYGEM__RESPONSE_CACHE_HPP
+#define MOUSYGEM__RESPONSE_CACHE_HPP
+
+#include <mousygem/response.hpp>
+#include <mousygem/statistics.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Mousygem {
+    class URI;
+    class Client;
+    
+    /**
+     * Cache of responses whose handlers gave them a TTL.
+     *
+     * Entries hold the formatted header and the data (shared and immutable), so a hit costs a hash lookup and a few reference count
+     * increments. The cache is split into shards, each with its own lock, to keep threads from contending on one lock.
+     *
+     * Since the key policy is chosen by the response, each path also remembers which policy its cached responses use, so the right key can be
+     * built before respond() is called. A path's responses must all use the same policy: if a handler gives the same path different ones
+     * (say, a per-certificate page for some clients and an anonymous page for the rest), the path isn't cached again until its cached
+     * responses expire, since there'd be no telling which key a request should be looked up with.
+     *
+     * When a shard is full, expired responses go first, then the least recently used ones.
+     *
+     * Keys are built in a buffer on the stack and entries are found by the key's hash (then checked against the whole key), so looking up
+     * a response doesn't allocate.
+     */
+    class ResponseCache {
+    public:
+        /**
+         * Create a cache
+         * @param max_bytes maximum number of bytes (of keys, headers, and data) to hold
+         */
+        ResponseCache(std::size_t max_bytes);
+        
+        /**
+         * Look up a cached response. This function is thread-safe.
+         * @param uri    URI requested
+         * @param client client requesting it
+         * @return response, if cached and not expired
+         */
+        std::optional<Response> find(const URI &uri, const Client &client);
+        
+        /**
+         * Cache a response if it has a TTL and can be cached. Its data may be moved into shared data. This function is thread-safe.
+         * @param uri      URI requested
+         * @param client   client requesting it
+         * @param response response to cache
+         */
+        void store(const URI &uri, const Client &client, Response &response);
+        
+        /**
+         * Drop all cached responses. This function is thread-safe.
+         */
+        void clear() noexcept;
+        
+        /**
+         * Get statistics. This function is thread-safe.
+         * @return statistics
+         */
+        ResponseCacheStatistics get_statistics() const;
+        
+        ResponseCache(const ResponseCache &) = delete;
+        ResponseCache &operator =(const ResponseCache &) = delete;
+    
+    private:
+        using Clock = std::chrono::steady_clock;
+        
+        /** A key being built, on the stack */
+        struct Key {
+            /** Longest key: a request's hostname, path, and input (1024 bytes at most), separators, and a certificate fingerprint */
+            static constexpr std::size_t CAPACITY = 1024 + 8 + 32;
+            
+            char data[CAPACITY];
+            std::size_t size = 0;
+            
+            /** Append to the key, returning false if it doesn't fit */
+            bool append(std::string_view string) noexcept;
+            
+            std::string_view view() const noexcept {
+                return std::string_view(this->data, this->size);
+            }
+        };
+        
+        struct Entry {
+            /** Full key (entries are found by its hash) */
+            std::string key;
+            
+            Response::ResponseCode code;
+            std::string meta;
+            std::shared_ptr<const std::string> header;
+            std::optional<std::variant<std::shared_ptr<const std::vector<std::byte>>, std::shared_ptr<const MappedFile>>> data;
+            Clock::time_point expires;
+            std::size_t size;
+            
+            /** Position in the shard's LRU list */
+            std::list<std::size_t>::iterator lru_position;
+        };
+        
+        struct Policy {
+            /** Base key (policies are found by its hash) */
+            std::string base;
+            
+            Response::CacheKey key;
+            Clock::time_point expires;
+            
+            /** Were responses with different policies given for the path? If so, it isn't cached until this expires. */
+            bool conflicted = false;
+        };
+        
+        struct Shard {
+            mutable std::mutex mutex;
+            
+            /** Key policy by the hash of the hostname and path */
+            std::unordered_map<std::size_t, Policy> policies;
+            
+            /** Responses by the hash of the full key */
+            std::unordered_map<std::size_t, Entry> entries;
+            
+            /** Hashes of the entries' keys, most recently used first */
+            std::list<std::size_t> lru;
+            
+            std::size_t bytes = 0;
+        };
+        
+        static constexpr std::size_t SHARD_COUNT = 16;
+        std::array<Shard, SHARD_COUNT> shards;
+        std::size_t max_shard_bytes;
+        
+        std::atomic<std::uint64_t> hits = 0;
+        std::atomic<std::uint64_t> misses = 0;
+        std::atomic<std::uint64_t> stores = 0;
+        std::atomic<std::uint64_t> evictions = 0;
+        
+        /** Build the key for the hostname and path, returning false if it's too long to cache */
+        static bool base_key(const URI &uri, Key &key) noexcept;
+        
+        /** Build the full key for a policy, returning false if it's too long to cache */
+        static bool full_key(const Key &base_key, Response::CacheKey policy, const URI &uri, const Client &client, Key &key) noexcept;
+        
+        /** Hash a key */
+        static std::size_t hash(const Key &key) noexcept {
+            return std::hash<std::string_view>()(key.view());
+        }
+        
+        /** Find the shard for a base key's hash */
+        Shard &shard_for(std::size_t base_hash) noexcept;
+        
+        /** Drop an entry (shard mutex must be held) */
+        static void erase(Shard &shard, std::unordered_map<std::size_t, Entry>::iterator entry) noexcept;
+        
+        /** Make room for an entry (shard mutex must be held) */
+        void make_room(Shard &shard, std::size_t size, Clock::time_point now);
+    };
+}
+
+#endif
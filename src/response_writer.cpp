@@ -0,0 +1,223 @@
+#include <mousygem/response.hpp>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <unistd.h>
+
+#include "response_writer.hpp"
+
+namespace Mousygem {
+    std::size_t ResponseWriter::format_header(const Response &response, char (&buffer)[1025]) noexcept {
+        const auto &meta = response.get_meta();
+        if(meta.size() == 0) {
+            std::fprintf(stderr, "Tried to send a response without meta\n");
+            return 0;
+        }
+        
+        auto meta_size = std::snprintf(buffer, sizeof(buffer), "%i %s\r\n", response.get_code(), meta.c_str());
+        if(meta_size < 0) {
+            std::fprintf(stderr, "Failed to encode the response data\n");
+            return 0;
+        }
+        
+        // Limit of 1024 bytes
+        if(static_cast<std::size_t>(meta_size) >= sizeof(buffer)) {
+            std::fprintf(stderr, "Response code and meta line is too long (%zu / %zu bytes)\n", static_cast<std::size_t>(meta_size), sizeof(buffer) - 1);
+            return 0;
+        }
+        
+        return static_cast<std::size_t>(meta_size);
+    }
+    
+    ResponseWriter::ResponseWriter(Response &response, bool use_sendfile) : response(response), use_sendfile(use_sendfile) {
+        // Cached responses were already formatted
+        if(response.formatted_header) {
+            this->header = response.formatted_header->data();
+            this->header_size = response.formatted_header->size();
+            return;
+        }
+        
+        this->header_size = format_header(response, this->header_buffer);
+    }
+    
+    bool ResponseWriter::is_sending_file() const noexcept {
+        return this->response.has_data() && std::holds_alternative<ResponseFile>(*this->response.data);
+    }
+    
+    bool ResponseWriter::get_memory_data(const std::byte *&data, std::size_t &size) const noexcept {
+        if(auto *data_vector = std::get_if<std::vector<std::byte>>(&*this->response.data)) {
+            data = data_vector->data();
+            size = data_vector->size();
+            return true;
+        }
+        if(auto *data_vector = std::get_if<std::pmr::vector<std::byte>>(&*this->response.data)) {
+            data = data_vector->data();
+            size = data_vector->size();
+            return true;
+        }
+        if(auto *shared_data = std::get_if<std::shared_ptr<const std::vector<std::byte>>>(&*this->response.data); shared_data && *shared_data) {
+            data = (*shared_data)->data();
+            size = (*shared_data)->size();
+            return true;
+        }
+        if(auto *mapped_file = std::get_if<std::shared_ptr<const MappedFile>>(&*this->response.data); mapped_file && *mapped_file) {
+            data = (*mapped_file)->data();
+            size = (*mapped_file)->size();
+            return true;
+        }
+        return false;
+    }
+    
+    std::size_t ResponseWriter::read_data(std::byte *buffer, std::size_t size) noexcept {
+        if(this->data_finished || !this->response.has_data() || size == 0) {
+            return 0;
+        }
+        
+        std::size_t buffer_len = 0;
+        
+        // In-memory (and mapped) data
+        const std::byte *memory_data;
+        std::size_t memory_size;
+        if(this->get_memory_data(memory_data, memory_size)) {
+            if(this->data_offset < memory_size) {
+                buffer_len = std::min<std::size_t>(size, memory_size - this->data_offset);
+                std::memcpy(buffer, memory_data + this->data_offset, buffer_len);
+                this->data_offset += buffer_len;
+            }
+        }
+        
+        // Streams
+        else if(auto *data_stream = std::get_if<std::ifstream>(&*this->response.data)) {
+            if(*data_stream) {
+                data_stream->read(reinterpret_cast<char *>(buffer), static_cast<std::streamsize>(size));
+                buffer_len = static_cast<std::size_t>(data_stream->gcount());
+            }
+            
+            // Running out is fine, but anything else means the data was cut short
+            if(data_stream->bad() || (data_stream->fail() && !data_stream->eof())) {
+                std::fprintf(stderr, "Failed to read response data from a stream\n");
+                this->data_failed = true;
+            }
+        }
+        
+        // Files
+        else if(auto *data_file = std::get_if<ResponseFile>(&*this->response.data)) {
+            if(this->data_offset < data_file->get_size()) {
+                auto data_to_read = std::min<std::uint64_t>(size, data_file->get_size() - this->data_offset);
+                auto read_len = pread(data_file->get_handle(), buffer, data_to_read, static_cast<off_t>(this->data_offset));
+                if(read_len > 0) {
+                    buffer_len = static_cast<std::size_t>(read_len);
+                    this->data_offset += buffer_len;
+                }
+                
+                // Either reading failed or the file got shorter
+                else {
+                    std::fprintf(stderr, "Failed to read response data from a file\n");
+                    this->data_failed = true;
+                }
+            }
+        }
+        
+        // Sources
+        else if(auto *data_source = std::get_if<ResponseSource>(&*this->response.data); data_source && *data_source) {
+            try {
+                buffer_len = (*data_source)(buffer, size);
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "Response data source failed: %s\n", e.what());
+                buffer_len = 0;
+                this->data_failed = true;
+            }
+            catch(...) {
+                std::fprintf(stderr, "Response data source failed\n");
+                buffer_len = 0;
+                this->data_failed = true;
+            }
+            
+            if(buffer_len > size) {
+                std::fprintf(stderr, "Response data source returned more data than the buffer can hold (%zu / %zu bytes)\n", buffer_len, size);
+                buffer_len = 0;
+                this->data_failed = true;
+            }
+        }
+        
+        // Don't ask again once it's done (or broken)
+        if(buffer_len == 0) {
+            this->data_finished = true;
+        }
+        return buffer_len;
+    }
+    
+    bool ResponseWriter::next_chunk(Chunk &chunk) {
+        if(!this->is_valid()) {
+            return false;
+        }
+        
+        chunk = Chunk();
+        
+        // Start small, then go up to full records
+        bool small_records = this->chunks_sent < SMALL_RECORD_COUNT;
+        std::size_t record_size = small_records ? SMALL_RECORD_SIZE : sizeof(this->stream_buffer);
+        
+        // The header goes first, with as much data as fits in the same record
+        if(!this->header_sent) {
+            this->header_sent = true;
+            std::memcpy(this->stream_buffer, this->header, this->header_size);
+            
+            chunk.data = this->stream_buffer;
+            chunk.size = this->header_size + this->read_data(this->stream_buffer + this->header_size, std::max(record_size, this->header_size) - this->header_size);
+            this->chunks_sent++;
+            return true;
+        }
+        
+        if(!this->response.has_data() || this->data_finished) {
+            return false;
+        }
+        
+        // In-memory (and mapped) data can be sent directly
+        const std::byte *memory_data;
+        std::size_t memory_size;
+        if(this->get_memory_data(memory_data, memory_size)) {
+            if(this->data_offset >= memory_size) {
+                return false;
+            }
+            
+            // Past the small records, hand over everything at once and let OpenSSL split it into full records
+            auto data_to_send = std::min<std::size_t>(memory_size - this->data_offset, small_records ? record_size : INT_MAX);
+            chunk.data = memory_data + this->data_offset;
+            chunk.size = data_to_send;
+            this->data_offset += data_to_send;
+            this->chunks_sent++;
+            return true;
+        }
+        
+        // Files can be handed straight to the kernel if it's doing the encryption
+        auto *data_file = std::get_if<ResponseFile>(&*this->response.data);
+        if(data_file && this->use_sendfile) {
+            if(this->data_offset >= data_file->get_size()) {
+                return false;
+            }
+            
+            auto data_to_send = std::min<std::uint64_t>(data_file->get_size() - this->data_offset, small_records ? record_size : INT_MAX);
+            chunk.file_handle = data_file->get_handle();
+            chunk.file_offset = this->data_offset;
+            chunk.size = static_cast<std::size_t>(data_to_send);
+            this->data_offset += data_to_send;
+            this->chunks_sent++;
+            return true;
+        }
+        
+        // Everything else is read into our buffer
+        auto buffer_len = this->read_data(this->stream_buffer, record_size);
+        if(buffer_len == 0) {
+            return false;
+        }
+        
+        chunk.data = this->stream_buffer;
+        chunk.size = buffer_len;
+        this->chunks_sent++;
+        return true;
+    }
+}
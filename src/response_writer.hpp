@@ -0,0 +1,155 @@
+#ifndef MOUSYGEM__RESPONSE_WRITER_HPP
+#define MOUSYGEM__RESPONSE_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Mousygem {
+    class Response;
+    
+    /**
+     * Splits a response into chunks that can be sent to a client, each of which should be passed to one SSL_write (or SSL_sendfile).
+     *
+     * The header shares the first chunk with the start of the data, so a small response goes out as a single TLS record (and usually a
+     * single TCP segment). Records start out small so that each one fits in a TCP segment and the client can use it as soon as it arrives,
+     * then grow to the full 16 KiB once the first round trip's worth has been sent, so bulk transfers aren't slowed down by per-record
+     * overhead.
+     *
+     * This is used by both the threaded and the epoll connection engines, so it never blocks on the client.
+     */
+    class ResponseWriter {
+    public:
+        /** Size of the first records, which fits a TCP segment with a typical MSS after TLS and TCP overhead */
+        static const constexpr std::size_t SMALL_RECORD_SIZE = 1360;
+        
+        /** Number of small records sent before switching to full records (about one initial congestion window) */
+        static const constexpr std::size_t SMALL_RECORD_COUNT = 10;
+        
+
+        /**
+         * Part of a response to send
+         */
+        struct Chunk {
+            /** Bytes to send (if file_handle is -1) */
+            const std::byte *data = nullptr;
+            
+            /** Number of bytes left to send */
+            std::size_t size = 0;
+            
+            /** File to send from with SSL_sendfile instead, or -1 */
+            int file_handle = -1;
+            
+            /** Offset in the file */
+            std::uint64_t file_offset = 0;
+            
+            /** Mark bytes as sent */
+            void consume(std::size_t bytes) noexcept {
+                if(this->file_handle >= 0) {
+                    this->file_offset += bytes;
+                }
+                else {
+                    this->data += bytes;
+                }
+                this->size -= bytes;
+            }
+        };
+        
+        /**
+         * Format the response header. The response must outlive the writer.
+         * @param response     response to write
+         * @param use_sendfile send file data as file chunks (only when kernel TLS is active on the connection)
+         */
+        ResponseWriter(Response &response, bool use_sendfile);
+        
+        /**
+         * Format a response's "NN meta\r\n" header, logging why if it can't be sent
+         * @param response response to format
+         * @param buffer   buffer to write to (including the null terminator)
+         * @return size of the header, or 0 if it's invalid
+         */
+        static std::size_t format_header(const Response &response, char (&buffer)[1025]) noexcept;
+        
+        /**
+         * Check if the header was formatted successfully. If not, nothing should be sent.
+         * @return true if valid
+         */
+        bool is_valid() const noexcept {
+            return this->header_size > 0;
+        }
+        
+        /**
+         * Check if the data is a ResponseFile
+         * @return true if sending a file
+         */
+        bool is_sending_file() const noexcept;
+        
+        /**
+         * Check if file data is sent with SSL_sendfile rather than being copied through a buffer
+         * @return true if using sendfile
+         */
+        bool is_using_sendfile() const noexcept {
+            return this->use_sendfile && this->is_sending_file();
+        }
+        
+        /**
+         * Get the next chunk to send. The first chunk holds the header. The chunk's data is valid until the next call.
+         * @param chunk chunk to fill (size is never greater than INT_MAX)
+         * @return true if a chunk was returned, false if there is nothing left to send (or the data failed; see has_failed())
+         */
+        bool next_chunk(Chunk &chunk);
+        
+        /**
+         * Check if the data couldn't be read (a source threw, or a file or stream failed), cutting the response short. If so, the client
+         * should be disconnected without a close_notify so it can tell the response is incomplete.
+         * @return true if the data failed
+         */
+        bool has_failed() const noexcept {
+            return this->data_failed;
+        }
+        
+        ResponseWriter(const ResponseWriter &) = delete;
+        ResponseWriter &operator =(const ResponseWriter &) = delete;
+    
+    private:
+        /** Response we're sending */
+        Response &response;
+        
+        /** Formatted "NN meta\r\n" line */
+        char header_buffer[1025];
+        
+        /** Header to send (either header_buffer or the response's preformatted header) */
+        const char *header = this->header_buffer;
+        
+        /** Size of the header (0 if invalid) */
+        std::size_t header_size = 0;
+        
+        /** Did we send the header? */
+        bool header_sent = false;
+        
+        /** Number of chunks returned so far */
+        std::size_t chunks_sent = 0;
+        
+        /** Did we run out of data (or fail to get more)? */
+        bool data_finished = false;
+        
+        /** Did we fail to get more data? */
+        bool data_failed = false;
+        
+        /** Send file data with SSL_sendfile? */
+        bool use_sendfile;
+        
+        /** Offset of the data sent so far (for in-memory data and files) */
+        std::uint64_t data_offset = 0;
+        
+        /** Buffer for the first chunk and for streamed and generated data (one full TLS record) */
+        std::byte stream_buffer[16384];
+        
+        /** Get the response's data if it's in memory (including shared data and mapped files) */
+        bool get_memory_data(const std::byte *&data, std::size_t &size) const noexcept;
+        
+        /** Copy up to size bytes of data into a buffer, returning how many were copied (0 once there's nothing left) */
+        std::size_t read_data(std::byte *buffer, std::size_t size) noexcept;
+    };
+}
+
+#endif
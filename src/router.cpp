@@ -0,0 +1,188 @@
+#include <mousygem/router.hpp>
+#include <mousygem/uri.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace Mousygem {
+    std::optional<std::string_view> Router::Parameters::get(std::string_view name) const noexcept {
+        if(this->names) {
+            for(std::size_t i = 0; i < this->names->size() && i < this->count; i++) {
+                if((*this->names)[i] == name) {
+                    return this->values[i];
+                }
+            }
+        }
+        return std::nullopt;
+    }
+    
+    void Router::add(std::string_view pattern, Handler handler) {
+        auto invalid = [&pattern](const char *reason) {
+            return std::invalid_argument(std::string(pattern) + " is not a valid route (" + reason + ")");
+        };
+        
+        if(pattern.empty() || pattern[0] != '/') {
+            throw invalid("it must start with a slash");
+        }
+        
+        auto route = std::make_unique<Route>();
+        route->pattern = pattern;
+        route->handler = std::move(handler);
+        
+        // Split it into segments and check them before touching the tree, so a bad pattern doesn't leave anything behind
+        std::vector<std::string_view> segments;
+        bool rest = false;
+        std::size_t position = 1;
+        while(true) {
+            auto end = pattern.find('/', position);
+            auto last = end == std::string_view::npos;
+            auto segment = pattern.substr(position, last ? std::string_view::npos : end - position);
+            
+            if(segment == "*") {
+                if(!last) {
+                    throw invalid("* must be the last segment");
+                }
+                rest = true;
+                break;
+            }
+            
+            if(!segment.empty() && segment.front() == '{' && segment.back() == '}') {
+                auto name = segment.substr(1, segment.size() - 2);
+                if(name.empty() || name.find_first_of("{}") != std::string_view::npos) {
+                    throw invalid("parameter names can't be empty or contain braces");
+                }
+                if(std::find(route->parameter_names.begin(), route->parameter_names.end(), name) != route->parameter_names.end()) {
+                    throw invalid("parameter names must be unique");
+                }
+                if(route->parameter_names.size() == MAX_PARAMETERS) {
+                    throw invalid("too many parameters");
+                }
+                route->parameter_names.emplace_back(name);
+            }
+            else if(segment.find_first_of("{}*") != std::string_view::npos) {
+                throw invalid("braces and * must make up a whole segment");
+            }
+            
+            segments.emplace_back(segment);
+            if(last) {
+                break;
+            }
+            position = end + 1;
+        }
+        
+        // Walk down the tree, adding nodes as we go (if it conflicts with another route, they all existed already)
+        auto *node = &this->root;
+        for(auto segment : segments) {
+            if(!segment.empty() && segment.front() == '{') {
+                if(!node->parameter_child) {
+                    node->parameter_child = std::make_unique<Node>();
+                }
+                node = node->parameter_child.get();
+                continue;
+            }
+            
+            // Keep children sorted so they can be binary searched
+            auto &children = node->children;
+            auto child = std::lower_bound(children.begin(), children.end(), segment, [](const auto &child, std::string_view segment) {
+                return child.first < segment;
+            });
+            if(child == children.end() || child->first != segment) {
+                child = children.emplace(child, std::string(segment), std::make_unique<Node>());
+            }
+            node = child->second.get();
+        }
+        
+        auto &slot = rest ? node->rest_route : node->route;
+        if(slot) {
+            throw std::invalid_argument(std::string(pattern) + " conflicts with " + slot->pattern);
+        }
+        slot = route.get();
+        this->routes.emplace_back(std::move(route));
+    }
+    
+    const Router::Route *Router::match(const Node &node, std::string_view path, Parameters &parameters) noexcept {
+        if(path.empty()) {
+            return node.route;
+        }
+        
+        // Split off the next segment
+        auto end = path.find('/', 1);
+        auto segment = path.substr(1, end == std::string_view::npos ? std::string_view::npos : end - 1);
+        auto next = end == std::string_view::npos ? std::string_view() : path.substr(end);
+        
+        // Exact segments first
+        auto &children = node.children;
+        auto child = std::lower_bound(children.begin(), children.end(), segment, [](const auto &child, std::string_view segment) {
+            return child.first < segment;
+        });
+        if(child != children.end() && child->first == segment) {
+            if(auto *route = match(*child->second, next, parameters)) {
+                return route;
+            }
+        }
+        
+        // Then parameters
+        if(node.parameter_child && !segment.empty() && parameters.count < MAX_PARAMETERS) {
+            auto index = parameters.count++;
+            parameters.values[index] = segment;
+            if(auto *route = match(*node.parameter_child, next, parameters)) {
+                return route;
+            }
+            parameters.count = index;
+        }
+        
+        // Then everything below here
+        if(node.rest_route) {
+            parameters.rest = path.substr(1);
+            return node.rest_route;
+        }
+        
+        return nullptr;
+    }
+    
+    const Router::Route *Router::find_route(std::string_view path, Parameters &parameters) const noexcept {
+        parameters = Parameters();
+        
+        // "gemini://example.com" is the same as "gemini://example.com/"
+        if(path.empty()) {
+            path = "/";
+        }
+        if(path[0] != '/') {
+            return nullptr;
+        }
+        
+        auto *route = match(this->root, path, parameters);
+        if(route) {
+            parameters.names = &route->parameter_names;
+        }
+        return route;
+    }
+    
+    const Router::Handler *Router::find(std::string_view path, Parameters &parameters) const noexcept {
+        auto *route = this->find_route(path, parameters);
+        return route ? &route->handler : nullptr;
+    }
+    
+    Response Router::respond(const URI &uri, const Client &client) const {
+        Parameters parameters;
+        auto *route = this->find_route(uri.raw_path(), parameters);
+        if(!route) {
+            this->unmatched.fetch_add(1, std::memory_order_relaxed);
+            return Response(Response::NotFound, "Not found");
+        }
+        
+        route->hits.fetch_add(1, std::memory_order_relaxed);
+        return route->handler(uri, client, parameters);
+    }
+    
+    RouterStatistics Router::get_statistics() const {
+        RouterStatistics statistics;
+        for(auto &route : this->routes) {
+            RouteStatistics route_statistics;
+            route_statistics.pattern = route->pattern;
+            route_statistics.hits = route->hits.load(std::memory_order_relaxed);
+            statistics.routes.emplace_back(std::move(route_statistics));
+        }
+        statistics.unmatched = this->unmatched.load(std::memory_order_relaxed);
+        return statistics;
+    }
+}
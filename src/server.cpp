@@ -4,28 +4,87 @@
 #include <mousygem/uri.hpp>
 #include <thread>
 #include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <stdexcept>
+#include <cstdlib>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
 
 #include "ssl_context.hpp"
 #include "socket.hpp"
+#include "response_writer.hpp"
+#include "response_cache.hpp"
+#include "epoll_engine.hpp"
+#include "worker_pool.hpp"
+#include "acceptor_shard.hpp"
+#include "timer_wheel.hpp"
+#include "metrics.hpp"
+#include "rate_limiter.hpp"
+#include "virtual_host.hpp"
 
 namespace Mousygem {
-    static std::runtime_error except_latest_error(const std::string &message) {
-        auto error_number = errno;
-        return std::runtime_error(message + ": " + strerrorname_np(error_number) + " - " + strerrordesc_np(error_number));
+    static std::string lowercase(std::string_view string) {
+        std::string result(string);
+        for(auto &c : result) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return result;
+    }
+    
+    static bool equals_ignoring_case(std::string_view a, std::string_view b) noexcept {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+    
+    /** Load a certificate (chain) and its private key into a context */
+    static void load_certificate(SSL_CTX *context, const std::filesystem::path &certificate, const std::filesystem::path &private_key) {
+        if(SSL_CTX_use_certificate_chain_file(context, certificate.string().c_str()) != 1) {
+            throw std::runtime_error("could not load the certificate from " + certificate.string());
+        }
+        if(SSL_CTX_use_PrivateKey_file(context, private_key.string().c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(context) != 1) {
+            throw std::runtime_error("could not load the private key for " + certificate.string() + " from " + private_key.string());
+        }
+    }
+    
+    /** Make a context for a virtual host, encrypting tickets with the server's keys */
+    static std::shared_ptr<SSLContext> create_virtual_host_context(const std::string &hostname, const std::filesystem::path &certificate, const std::filesystem::path &private_key, const std::shared_ptr<SessionTicketKeys> &ticket_keys) {
+        auto context = std::make_shared<SSLContext>();
+        load_certificate(context->get_context(), certificate, private_key);
+        context->set_session_ticket_keys(ticket_keys);
+        
+        // Give each host its own session ID context (copied to the connection when switching to it) so sessions can't be resumed on
+        // another host. It's limited to 32 bytes, so use a hash of the hostname.
+        auto session_id_context = "mousygem:" + std::to_string(std::hash<std::string>()(hostname));
+        SSL_CTX_set_session_id_context(context->get_context(), reinterpret_cast<const unsigned char *>(session_id_context.data()), static_cast<unsigned int>(session_id_context.size()));
+        return context;
     }
     
     Server::Server(const char *ip_hostname, std::uint16_t port) {
-        this->ssl_context = std::make_unique<SSLContext>();
+        this->ssl_context = std::make_shared<SSLContext>();
+        this->metrics = std::make_unique<ServerMetrics>();
+        this->set_kernel_tls(true);
+        this->set_session_cache(20480);
+        this->set_response_cache_size(64 * 1024 * 1024);
         
-        // Enable peer verification
-        SSL_CTX_set_verify(this->ssl_context->get_context(), SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, [](int, X509_STORE_CTX *) {
-            return 1;
-        });
+        // Used for waking up accept_clients() when shutting down
+        this->shutdown_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(this->shutdown_event < 0) {
+            throw except_latest_error("eventfd failed");
+        }
+        
+        this->set_up_ssl_context(*this->ssl_context);
         
         // I hate BSD sockets. Let's begin.
         sockaddr_storage address = {};
@@ -65,41 +124,586 @@ namespace Mousygem {
         this->ipv4_and_ipv6 = ip_hostname == nullptr;
     }
     
+    void Server::set_up_ssl_context(SSLContext &context) {
+        // Enable peer verification
+        SSL_CTX_set_verify(context.get_context(), SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE, [](int, X509_STORE_CTX *store) {
+            remember_peer_certificate_fingerprint(store);
+            return 1;
+        });
+        
+        // Switch to a virtual host's certificate if the client asks for one with SNI. Sessions, tickets, and peer verification are still
+        // handled by this context. This is done when the ClientHello arrives, before looking for a session to resume, so the virtual host's
+        // session ID context is the one checked.
+        #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_client_hello_cb(context.get_context(), [](SSL *ssl, int *, void *argument) {
+            auto *server = reinterpret_cast<Server *>(argument);
+            const unsigned char *extension;
+            std::size_t extension_size;
+            if(server->virtual_hosts.empty() || !SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_server_name, &extension, &extension_size)) {
+                return static_cast<int>(SSL_CLIENT_HELLO_SUCCESS);
+            }
+            
+            // A list (which has exactly one host_name entry in practice) of a 1-byte type, a 2-byte length, and the name
+            if(extension_size >= 5 && extension[2] == TLSEXT_NAMETYPE_host_name) {
+                std::size_t list_size = (extension[0] << 8) | extension[1];
+                std::size_t name_size = (extension[3] << 8) | extension[4];
+                if(list_size + 2 <= extension_size && name_size + 3 <= list_size) {
+                    auto *host = server->find_virtual_host(std::string_view(reinterpret_cast<const char *>(extension + 5), name_size));
+                    if(host) {
+                        SSL_set_SSL_CTX(ssl, std::atomic_load(&host->ssl_context)->get_context());
+                    }
+                }
+            }
+            return static_cast<int>(SSL_CLIENT_HELLO_SUCCESS);
+        }, this);
+        #else
+        int (*select_virtual_host)(SSL *, int *, void *) = [](SSL *ssl, int *, void *argument) {
+            auto *server = reinterpret_cast<Server *>(argument);
+            auto *server_name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+            if(server_name && !server->virtual_hosts.empty()) {
+                auto *host = server->find_virtual_host(server_name);
+                if(host) {
+                    SSL_set_SSL_CTX(ssl, std::atomic_load(&host->ssl_context)->get_context());
+                }
+            }
+            return static_cast<int>(SSL_TLSEXT_ERR_OK);
+        };
+        SSL_CTX_set_tlsext_servername_callback(context.get_context(), select_virtual_host);
+        SSL_CTX_set_tlsext_servername_arg(context.get_context(), this);
+        #endif
+    }
+    
+    std::shared_ptr<SSLContext> Server::get_ssl_context() const {
+        return std::atomic_load(&this->ssl_context);
+    }
+    
     void Server::use_certificate_file(const std::filesystem::path &path) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::use_certificate_file() called while accepting clients");
+        }
         SSL_CTX_use_certificate_file(this->ssl_context->get_context(), path.string().c_str(), SSL_FILETYPE_PEM);
     }
-        
+    
     void Server::use_private_key_file(const std::filesystem::path &path) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::use_private_key_file() called while accepting clients");
+        }
         SSL_CTX_use_PrivateKey_file(this->ssl_context->get_context(), path.string().c_str(), SSL_FILETYPE_PEM);
     }
     
-    void Server::serve_client(Server *server, void *ssl_handle, Client *client) noexcept {
-        // Assign to a unique_ptr to avoid leakage
-        std::unique_ptr<Client> client_unique_ptr(client);
+    void Server::add_virtual_host(const std::string &hostname, const std::filesystem::path &certificate, const std::filesystem::path &private_key, VirtualHostHandler handler) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::add_virtual_host() called while accepting clients");
+        }
         
-        // Let's do this
+        auto key = lowercase(hostname);
+        if(key.empty()) {
+            throw std::invalid_argument("Server::add_virtual_host() given an empty hostname");
+        }
+        if(this->virtual_hosts.count(key)) {
+            throw std::invalid_argument("Server::add_virtual_host() given " + hostname + " more than once");
+        }
+        
+        auto host = std::make_unique<VirtualHost>();
+        host->hostname = std::move(key);
+        host->handler = std::move(handler);
+        host->ssl_context = create_virtual_host_context(host->hostname, certificate, private_key, this->ssl_context->get_session_ticket_keys());
+        
+        std::string_view host_key = host->hostname;
+        this->virtual_hosts.emplace(host_key, std::move(host));
+    }
+    
+    void Server::reload_certificate(const std::filesystem::path &certificate, const std::filesystem::path &private_key) {
+        std::lock_guard<std::mutex> lock(this->reload_mutex);
+        auto previous = this->get_ssl_context();
+        auto *previous_context = previous->get_context();
+        
+        auto context = std::make_shared<SSLContext>();
+        auto *new_context = context->get_context();
+        load_certificate(new_context, certificate, private_key);
+        this->set_up_ssl_context(*context);
+        
+        // Keep everything set with set_kernel_tls(), set_session_cache(), and set_session_tickets()
+        context->set_session_ticket_keys(previous->get_session_ticket_keys());
+        SSL_CTX_clear_options(new_context, SSL_CTX_get_options(new_context));
+        SSL_CTX_set_options(new_context, SSL_CTX_get_options(previous_context));
+        SSL_CTX_set_session_cache_mode(new_context, SSL_CTX_get_session_cache_mode(previous_context));
+        SSL_CTX_sess_set_cache_size(new_context, SSL_CTX_sess_get_cache_size(previous_context));
+        SSL_CTX_set_timeout(new_context, SSL_CTX_get_timeout(previous_context));
+        
+        // Connections already made hold their own reference to the old context
+        std::atomic_store(&this->ssl_context, std::move(context));
+    }
+    
+    void Server::reload_virtual_host_certificate(const std::string &hostname, const std::filesystem::path &certificate, const std::filesystem::path &private_key) {
+        auto host = this->virtual_hosts.find(hostname);
+        if(host == this->virtual_hosts.end()) {
+            throw std::invalid_argument("Server::reload_virtual_host_certificate() given " + hostname + ", which isn't a virtual host");
+        }
+        
+        std::lock_guard<std::mutex> lock(this->reload_mutex);
+        auto context = create_virtual_host_context(host->second->hostname, certificate, private_key, this->get_ssl_context()->get_session_ticket_keys());
+        std::atomic_store(&host->second->ssl_context, std::move(context));
+    }
+    
+    std::size_t Server::HostnameHash::operator()(std::string_view hostname) const noexcept {
+        // FNV-1a over the lowercase hostname
+        std::uint64_t hash = 0xCBF29CE484222325;
+        for(auto c : hostname) {
+            hash ^= static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(c)));
+            hash *= 0x100000001B3;
+        }
+        return static_cast<std::size_t>(hash);
+    }
+    
+    bool Server::HostnameEqual::operator()(std::string_view a, std::string_view b) const noexcept {
+        return equals_ignoring_case(a, b);
+    }
+    
+    const VirtualHost *Server::find_virtual_host(std::string_view hostname) const {
+        auto host = this->virtual_hosts.find(hostname);
+        return host == this->virtual_hosts.end() ? nullptr : host->second.get();
+    }
+    
+    void Server::set_kernel_tls(bool enabled) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_kernel_tls() called while accepting clients");
+        }
+        
+        #ifdef SSL_OP_ENABLE_KTLS
+        if(enabled) {
+            SSL_CTX_set_options(this->ssl_context->get_context(), SSL_OP_ENABLE_KTLS);
+        }
+        else {
+            SSL_CTX_clear_options(this->ssl_context->get_context(), SSL_OP_ENABLE_KTLS);
+        }
+        #else
+        (void)enabled;
+        #endif
+    }
+    
+    void Server::set_session_cache(std::size_t size, std::chrono::seconds lifetime) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_session_cache() called while accepting clients");
+        }
+        
+        auto *context = this->ssl_context->get_context();
+        SSL_CTX_set_session_cache_mode(context, size == 0 ? SSL_SESS_CACHE_OFF : SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(context, static_cast<long>(size));
+        SSL_CTX_set_timeout(context, static_cast<long>(lifetime.count()));
+        this->session_lifetime = lifetime;
+        
+        // Tickets can't outlive the sessions they resume
+        auto &keys = this->ssl_context->get_session_ticket_keys();
+        if(keys) {
+            keys->set_rotation_interval(this->session_ticket_rotation, lifetime);
+        }
+    }
+    
+    void Server::set_session_tickets(bool enabled, std::chrono::seconds key_rotation_interval) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_session_tickets() called while accepting clients");
+        }
+        
+        this->session_ticket_rotation = key_rotation_interval;
+        
+        if(!enabled) {
+            this->ssl_context->set_session_ticket_keys(nullptr);
+            for(auto &host : this->virtual_hosts) {
+                host.second->ssl_context->set_session_ticket_keys(nullptr);
+            }
+            return;
+        }
+        
+        auto keys = this->ssl_context->get_session_ticket_keys();
+        if(!keys) {
+            keys = std::make_shared<SessionTicketKeys>();
+        }
+        keys->set_rotation_interval(key_rotation_interval, this->session_lifetime);
+        for(auto &host : this->virtual_hosts) {
+            host.second->ssl_context->set_session_ticket_keys(keys);
+        }
+        this->ssl_context->set_session_ticket_keys(std::move(keys));
+    }
+    
+    SessionStatistics Server::get_session_statistics() const noexcept {
+        SessionStatistics statistics;
+        statistics.resumed_handshakes = this->resumed_handshakes;
+        statistics.full_handshakes = this->full_handshakes;
+        auto context = this->get_ssl_context();
+        statistics.cached_sessions = static_cast<std::uint64_t>(SSL_CTX_sess_number(context->get_context()));
+        
+        auto &keys = context->get_session_ticket_keys();
+        if(keys) {
+            statistics.ticket_key_rotations = keys->get_rotation_count();
+        }
+        
+        return statistics;
+    }
+    
+    void Server::handshake_completed(void *ssl_handle) noexcept {
+        if(SSL_session_reused(reinterpret_cast<SSL *>(ssl_handle))) {
+            this->resumed_handshakes++;
+        }
+        else {
+            this->full_handshakes++;
+        }
+    }
+    
+    void Server::set_response_cache_size(std::size_t max_bytes) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_response_cache_size() called while accepting clients");
+        }
+        
+        this->response_cache = max_bytes == 0 ? nullptr : std::make_unique<ResponseCache>(max_bytes);
+    }
+    
+    void Server::clear_response_cache() noexcept {
+        if(this->response_cache) {
+            this->response_cache->clear();
+        }
+    }
+    
+    ResponseCacheStatistics Server::get_response_cache_statistics() const {
+        if(!this->response_cache) {
+            return ResponseCacheStatistics();
+        }
+        return this->response_cache->get_statistics();
+    }
+    
+    void Server::set_timeouts(const Timeouts &timeouts) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_timeouts() called while accepting clients");
+        }
+        
+        this->timeouts = timeouts;
+    }
+    
+    TimeoutStatistics Server::get_timeout_statistics() const noexcept {
+        TimeoutStatistics statistics;
+        statistics.handshake_timeouts = this->handshake_timeouts;
+        statistics.request_timeouts = this->request_timeouts;
+        statistics.write_timeouts = this->write_timeouts;
+        return statistics;
+    }
+    
+    void Server::count_timeout(int phase) noexcept {
+        switch(static_cast<ConnectionPhase>(phase)) {
+            case ConnectionPhase::Handshake:
+                this->handshake_timeouts++;
+                break;
+            case ConnectionPhase::Request:
+                this->request_timeouts++;
+                break;
+            case ConnectionPhase::Write:
+                this->write_timeouts++;
+                break;
+        }
+    }
+    
+    ServerStatistics Server::get_statistics() const {
+        auto statistics = this->metrics->snapshot();
+        
+        std::lock_guard<std::mutex> lock(this->connected_clients_mutex);
+        statistics.active_connections = this->connected_clients;
+        return statistics;
+    }
+    
+    std::string Server::get_prometheus_metrics() const {
+        return format_prometheus_metrics(this->get_statistics(), this->get_timeout_statistics(), this->get_session_statistics(), this->get_response_cache_statistics(), this->get_rate_limit_statistics());
+    }
+    
+    void Server::set_rate_limits(const RateLimits &limits) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_rate_limits() called while accepting clients");
+        }
+        if(!(limits.requests_per_second >= 0.0) || limits.burst > RateLimiter::MAX_BURST || limits.table_size == 0) {
+            throw std::invalid_argument("invalid rate limits");
+        }
+        
+        if(limits.requests_per_second == 0.0 && limits.connections == 0) {
+            this->rate_limiter = nullptr;
+            return;
+        }
+        
+        // Allow at least one request at a time, or nobody could get through
+        auto burst = limits.burst;
+        if(burst == 0) {
+            burst = static_cast<unsigned int>(std::min(std::ceil(limits.requests_per_second), static_cast<double>(RateLimiter::MAX_BURST)));
+        }
+        this->rate_limiter = std::make_unique<RateLimiter>(limits.requests_per_second, std::max(burst, 1U), limits.connections, limits.table_size);
+    }
+    
+    RateLimitStatistics Server::get_rate_limit_statistics() const noexcept {
+        if(!this->rate_limiter) {
+            return RateLimitStatistics();
+        }
+        return this->rate_limiter->get_statistics();
+    }
+    
+    void Server::set_status_path(const std::string &path) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_status_path() called while accepting clients");
+        }
+        
+        this->status_path = path;
+    }
+    
+    FileTransferStatistics Server::get_file_transfer_statistics() const noexcept {
+        FileTransferStatistics statistics;
+        statistics.sendfile_responses = this->sendfile_responses;
+        statistics.copied_responses = this->copied_responses;
+        return statistics;
+    }
+    
+    void Server::begin_response(Server *server, void *ssl_handle, Response &response, std::optional<ResponseWriter> &writer) {
+        auto *ssl = reinterpret_cast<SSL *>(ssl_handle);
+        writer.emplace(response, BIO_get_ktls_send(SSL_get_wbio(ssl)) != 0);
+        
+        server->metrics->count_response(response.get_code());
+        
+        if(writer->is_sending_file()) {
+            (writer->is_using_sendfile() ? server->sendfile_responses : server->copied_responses)++;
+        }
+    }
+    
+    void Server::set_connection_engine(ConnectionEngine engine, unsigned int loop_threads) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_connection_engine() called while accepting clients");
+        }
+        
+        this->connection_engine = engine;
+        this->epoll_loop_threads = loop_threads;
+    }
+    
+    void Server::set_worker_pool(std::size_t threads, std::size_t queue_capacity, Backpressure backpressure) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_worker_pool() called while accepting clients");
+        }
+        
+        this->worker_threads = threads;
+        this->worker_queue_capacity = queue_capacity;
+        this->worker_backpressure = backpressure;
+    }
+    
+    WorkerPoolStatistics Server::get_worker_pool_statistics() const {
+        std::lock_guard<std::mutex> lock(this->worker_pool_mutex);
+        if(!this->worker_pool) {
+            return WorkerPoolStatistics();
+        }
+        return this->worker_pool->get_statistics();
+    }
+    
+    Response Server::respond(const URI &, const Client &) {
+        throw std::logic_error("Server::respond() and Server::respond_async() were not overridden");
+    }
+    
+    void Server::respond_async(const URI &url, const Client &client, ResponseCallback callback) {
+        callback(this->respond(url, client));
+    }
+    
+    void Server::dispatch_request(const URI &uri, const Client &client, ResponseCallback callback) {
+        if(client.virtual_host && client.virtual_host->handler) {
+            callback(client.virtual_host->handler(uri, client));
+        }
+        else {
+            this->respond_async(uri, client, std::move(callback));
+        }
+    }
+    
+    Response Server::wait_for_response(const URI &uri, const Client &client) {
+        struct {
+            std::mutex mutex;
+            std::condition_variable done;
+            std::optional<Response> response;
+        } pending;
+        
+        this->dispatch_request(uri, client, [&pending](Response response) {
+            // Notify while holding the lock, since pending is gone as soon as the wait sees the response
+            std::lock_guard<std::mutex> lock(pending.mutex);
+            pending.response.emplace(std::move(response));
+            pending.done.notify_one();
+        });
+        
+        std::unique_lock<std::mutex> lock(pending.mutex);
+        pending.done.wait(lock, [&pending]() { return pending.response.has_value(); });
+        return std::move(*pending.response);
+    }
+    
+    std::optional<Response> Server::begin_request(Server *server, void *ssl_handle, const char *request, std::size_t request_size, bool request_ok, Client *client, std::optional<URI> &uri) noexcept {
         auto *ssl = reinterpret_cast<SSL *>(ssl_handle);
         
-        auto response = Response(Response::ResponseCode::TemporaryFailure, "error");
+        if(!request_ok) {
+            return Response(Response::ResponseCode::TemporaryFailure, "error");
+        }
+        
+        // Slow down clients over their limits before doing anything else for them
+        if(server->rate_limiter) {
+            if(client->over_connection_limit) {
+                return Response(Response::SlowDown, "1");
+            }
+            auto wait = server->rate_limiter->take_request(client->rate_limit_entry);
+            if(wait.has_value()) {
+                return Response(Response::SlowDown, std::to_string(*wait));
+            }
+        }
+        
+        // Validate it.
+        try {
+            uri.emplace(std::string_view(request, request_size), client->get_memory_resource());
+            
+            // Only accept gemini connections
+            if(uri->raw_protocol() != "gemini") {
+                uri.reset();
+                return Response(Response::ResponseCode::BadRequest, "invalid protocol (this server only accepts gemini:// requests)");
+            }
+        }
+        catch(std::exception &) {
+            uri.reset();
+            return Response(Response::ResponseCode::BadRequest, "invalid uri");
+        }
+        
+        // Find the virtual host it's for, making sure it's the host the client connected to
+        auto *server_name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+        if(server_name) {
+            client->server_name = server_name;
+        }
+        if(!server->virtual_hosts.empty()) {
+            auto hostname = uri->raw_hostname();
+            if(server_name && !equals_ignoring_case(hostname, server_name)) {
+                return Response(Response::ProxyRequestRefused, "wrong host");
+            }
+            client->virtual_host = server->find_virtual_host(hostname);
+        }
+        
+        // Built-in status page
+        if(!server->status_path.empty() && uri->raw_path() == server->status_path) {
+            try {
+                return Response(Response::Success, "text/plain; version=0.0.4", server->get_prometheus_metrics());
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "Exception error when handling request: %s\n", e.what());
+                return Response(Response::TemporaryFailure, "server error");
+            }
+        }
+        
+        // Check if we got a certificate from them (it's only encoded if the handler asks for it)
+        auto *peer_certificate = SSL_get_peer_certificate(ssl);
+        if(peer_certificate) {
+            client->peer_certificate = peer_certificate;
+            Client::CertificateFingerprint fingerprint;
+            if(get_peer_certificate_fingerprint(ssl, fingerprint)) {
+                client->certificate_fingerprint = fingerprint;
+            }
+        }
+        
+        // Use a cached response if we have one
+        if(server->response_cache) {
+            try {
+                auto cached_response = server->response_cache->find(*uri, *client);
+                if(cached_response.has_value()) {
+                    return cached_response;
+                }
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "Exception error when handling request: %s\n", e.what());
+                return Response(Response::TemporaryFailure, "server error");
+            }
+        }
+        
+        return std::nullopt;
+    }
+    
+    Response Server::finish_request(Server *server, const URI *uri, const Client &client, Response response) noexcept {
+        auto code = response.get_code();
+        
+        // Can we respond without breaking gemini spec?
+        if((code < 20 || code > 29) && response.has_data()) {
+            std::fprintf(stderr, "Tried to send a non-success response (i.e. 2x) with data\n");
+            return Response(Response::TemporaryFailure, "server error");
+        }
+        
+        // Keep it for next time if it has a TTL
+        if(uri && server->response_cache) {
+            try {
+                server->response_cache->store(*uri, client, response);
+            }
+            catch(std::exception &e) {
+                std::fprintf(stderr, "Exception error when caching a response: %s\n", e.what());
+            }
+        }
+        
+        return response;
+    }
+    
+    Response Server::handle_request(Server *server, void *ssl_handle, const char *request, std::size_t request_size, bool request_ok, Client *client) noexcept {
+        std::optional<URI> requested_uri;
+        auto response = begin_request(server, ssl_handle, request, request_size, request_ok, client, requested_uri);
+        if(response.has_value()) {
+            return std::move(*response);
+        }
+        
+        try {
+            return finish_request(server, &*requested_uri, *client, server->wait_for_response(*requested_uri, *client));
+        }
+        catch(std::exception &e) {
+            std::fprintf(stderr, "Exception error when handling request: %s\n", e.what());
+            return Response(Response::TemporaryFailure, "server error");
+        }
+    }
+    
+    void Server::serve_client(Server *server, Client *client) noexcept {
+        // Make a new SSL thingy
+        auto *ssl = SSL_new(server->get_ssl_context()->get_context());
+        if(!ssl) {
+            server->client_disconnected(client);
+            return;
+        }
+        
+        // Let's do this
         SSL_set_fd(ssl, *client->socket->socket);
         
-        bool error = false;
+        // Write whatever the client will take so the write deadline is reset as often as possible
+        SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE);
+        
+        // If the client misses a deadline, the timer thread shuts down its socket, which fails whatever we're blocked on
+        TimerWheel::Timer deadline;
+        deadline.context = client;
+        auto set_deadline = [server, &deadline](ConnectionPhase phase, std::chrono::milliseconds timeout) {
+            if(timeout.count() > 0) {
+                deadline.kind = static_cast<int>(phase);
+                server->timer_thread->schedule(deadline, timeout);
+            }
+            else {
+                server->timer_thread->cancel(deadline);
+            }
+        };
+        
+        // Time each phase as we go
+        auto &metrics = *server->metrics;
+        auto phase_start = metrics.record(LatencyPhase::AcceptWait, client->accepted_at);
+        std::uint64_t bytes_sent = 0;
         
         // Try to accept it
-        if(!SSL_accept(ssl)) {
+        set_deadline(ConnectionPhase::Handshake, server->timeouts.handshake);
+        if(SSL_accept(ssl) <= 0) {
             goto ssl_cleanup_spaghetti;
         }
+        server->handshake_completed(ssl);
+        phase_start = metrics.record(LatencyPhase::Handshake, phase_start);
         
-        // Get the URL
+        // Get the URL and respond
         {
             char uri_input[1027] = {};
             int offset = 0;
+            bool request_ok = true;
             
             // Build the URL
+            set_deadline(ConnectionPhase::Request, server->timeouts.request);
             while(true) {
                 int new_offset = SSL_read(ssl, uri_input + offset, (sizeof(uri_input) - 1) - offset);
                 if(new_offset <= 0) {
-                    error = true;
+                    request_ok = false;
                     break;
                 }
                 
@@ -109,171 +713,284 @@ namespace Mousygem {
                 }
             }
             
-            std::optional<URI> requested_uri;
-            
-            // Validate it.
-            if(!error) {
-                try {
-                    requested_uri = std::string(uri_input, offset - 2);
-                    
-                    // Only accept gemini connections
-                    if(requested_uri->protocol() != "gemini") {
-                        error = true;
-                        response = Response(Response::ResponseCode::BadRequest, "invalid protocol (this server only accepts gemini:// requests)");
-                    }
-                }
-                catch(std::exception &) {
-                    error = true;
-                    response = Response(Response::ResponseCode::BadRequest, "invalid uri");
-                }
+            if(request_ok) {
+                phase_start = metrics.record(LatencyPhase::RequestRead, phase_start);
             }
             
-            // Get the response
-            if(!error) {
-                // Check if we got a certificate from them
-                auto *peer_certificate = SSL_get_peer_certificate(ssl);
-                if(peer_certificate) {
-                    unsigned char *data = nullptr;
-                    int length = i2d_X509(peer_certificate, &data);
-                    client->certificate = std::vector<std::byte>(reinterpret_cast<std::byte *>(data), reinterpret_cast<std::byte *>(data) + length);
-                    OPENSSL_free(data);
-                }
-                
-                try {
-                    response = server->respond(*requested_uri, *client);
-                }
-                catch (std::exception &e) {
-                    std::fprintf(stderr, "Exception error when handling request: %s\n", e.what());
-                    response = Response(Response::TemporaryFailure, "server error");
-                }
-            }
-        }
-        
-        // Can we respond without breaking gemini spec?
-        {
-            auto code = response.get_code();
-            if((code < 20 || code > 29) && response.has_data()) {
-                std::fprintf(stderr, "Tried to send a non-success response (i.e. 2x) with data\n");
-                response = Response(Response::TemporaryFailure, "server error");
-                code = response.get_code();
-            }
-        
-            // Send the meta
-            {
-                const auto &meta = response.get_meta();
-                if(meta.size() == 0) {
-                    std::fprintf(stderr, "Tried to send a response without meta\n");
-                    goto ssl_cleanup_spaghetti;
-                }
-                
-                char response_data[1025];
-                auto meta_size = std::snprintf(response_data, sizeof(response_data), "%i %s\r\n", code, meta.c_str());
-                if(meta_size < 0) {
-                    std::fprintf(stderr, "Failed to encode the response data\n");
-                    goto ssl_cleanup_spaghetti;
-                }
-                
-                // Limit of 1024 bytes
-                if(static_cast<std::size_t>(meta_size) >= sizeof(response_data)) {
-                    std::fprintf(stderr, "Response code and meta line is too long (%zu / %zu bytes)\n", static_cast<std::size_t>(meta_size), sizeof(response_data) - 1);
-                    goto ssl_cleanup_spaghetti;
+            // The handler's time isn't the client's fault
+            server->timer_thread->cancel(deadline);
+            
+            auto response = handle_request(server, ssl, uri_input, request_ok ? offset - 2 : 0, request_ok, client);
+            phase_start = metrics.record(LatencyPhase::Respond, phase_start);
+            
+            // Send the header and the data
+            set_deadline(ConnectionPhase::Write, server->timeouts.write);
+            std::optional<ResponseWriter> writer;
+            begin_response(server, ssl, response, writer);
+            
+            ResponseWriter::Chunk chunk;
+            bool header_sent = false;
+            while(writer->next_chunk(chunk)) {
+                while(chunk.size > 0) {
+                    auto sent = chunk.file_handle >= 0 ? SSL_sendfile(ssl, chunk.file_handle, static_cast<off_t>(chunk.file_offset), chunk.size, 0) : SSL_write(ssl, chunk.data, static_cast<int>(chunk.size));
+                    if(sent <= 0) {
+                        #ifdef DEBUG
+                        std::fprintf(stderr, "Failed to send a response to a client\n");
+                        #endif
+                        goto ssl_cleanup_spaghetti;
+                    }
+                    chunk.consume(static_cast<std::size_t>(sent));
+                    bytes_sent += static_cast<std::uint64_t>(sent);
+                    set_deadline(ConnectionPhase::Write, server->timeouts.write);
                 }
                 
-                // Send that
-                if(SSL_write(ssl, response_data, meta_size) <= 0) {
-                    #ifdef DEBUG
-                    std::fprintf(stderr, "Failed to send response header to a client\n");
-                    #endif
-                    goto ssl_cleanup_spaghetti;
+                // The header is always in the first chunk
+                if(!header_sent) {
+                    header_sent = true;
+                    phase_start = metrics.record(LatencyPhase::HeaderWrite, phase_start);
                 }
             }
-        }
-        
-        // Next, send the data if we have it
-        if(response.has_data()) {
-            auto *data_vector = std::get_if<std::vector<std::byte>>(&*response.data);
-            if(data_vector) {
-                std::size_t bytes_sent = 0;
-                while(bytes_sent < data_vector->size()) {
-                    auto data_to_send = data_vector->size() - bytes_sent;
-                    if(data_to_send > INT_MAX) {
-                        data_to_send = INT_MAX;
-                    }
-                    if(SSL_write(ssl, data_vector->data() + bytes_sent, data_to_send) <= 0) {
-                        std::fprintf(stderr, "Failed to send data bytes to a client\n");
-                        goto ssl_cleanup_spaghetti;
-                    }
-                    bytes_sent += data_to_send;
-                }
+            if(header_sent) {
+                metrics.record(LatencyPhase::BodyWrite, phase_start);
             }
             
-            auto *data_stream = std::get_if<std::ifstream>(&*response.data);
-            if(data_stream) {
-                while(*data_stream) {
-                    char stream_buffer[4096];
-                    std::size_t buffer_len = 0;
-                    
-                    // Go through the file
-                    while(true) {
-                        // Check if EOF
-                        auto next_char = data_stream->get();
-                        if(next_char == EOF) {
-                            break;
-                        }
-                        
-                        // We didn't. Set the character here.
-                        stream_buffer[buffer_len] = next_char;
-                        
-                        // Check if we hit the max buffer size
-                        buffer_len++;
-                        if(buffer_len == sizeof(stream_buffer)) {
-                            break;
-                        }
-                    }
-                    
-                    // Send it if we can
-                    if(buffer_len) {
-                        if(SSL_write(ssl, stream_buffer, buffer_len) <= 0) {
-                            #ifdef DEBUG
-                            std::fprintf(stderr, "Failed to send data stream to a client\n");
-                            #endif
-                            goto ssl_cleanup_spaghetti;
-                        }
-                    }
-                }
+            // Leave out the close_notify so the client can tell the response was cut short
+            if(writer->has_failed()) {
+                SSL_set_quiet_shutdown(ssl, 1);
             }
         }
         
         // Spaghetti goto code
         ssl_cleanup_spaghetti:
         
-        // Decrement client count (we're done)
-        server->connected_clients_mutex.lock();
-        server->connected_clients--;
-        server->connected_clients_mutex.unlock();
+        // Make sure the timer thread is done with the client
+        server->timer_thread->cancel(deadline);
+        metrics.bytes_sent.fetch_add(bytes_sent, std::memory_order_relaxed);
         
         // Cleanup
         SSL_shutdown(ssl);
         SSL_free(ssl);
-        client->socket->destroy();
+        
+        // Decrement client count (we're done)
+        server->client_disconnected(client);
     }
+    
+    void Server::set_listen_options(const ListenOptions &options) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::set_listen_options() called while accepting clients");
+        }
         
-    void Server::accept_clients(unsigned long maximum_parallel_connections) {
-        // Can we do that?
+        this->listen_options = options;
+    }
+    
+    void Server::set_acceptor_shards(unsigned int shard_count, bool pin_to_cpus) {
         if(this->server_running) {
-            throw std::runtime_error("Server::accept_clients() called while accepting clients");
+            throw std::runtime_error("Server::set_acceptor_shards() called while accepting clients");
         }
-        if(!this->shutdown_mutex.try_lock()) {
-            throw std::runtime_error("Server::accept_clients() called while shutting down");
+        
+        this->acceptor_shard_count = shard_count;
+        this->pin_acceptors_to_cpus = pin_to_cpus;
+    }
+    
+    void Server::use_listening_sockets(const std::vector<int> &sockets) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::use_listening_sockets() called while accepting clients");
         }
-        this->shutdown_mutex.unlock();
         
-        // Start
-        this->server_running = true;
+        for(auto socket_handle : sockets) {
+            int listening = 0, type = 0;
+            socklen_t listening_size = sizeof(listening), type_size = sizeof(type);
+            if(getsockopt(socket_handle, SOL_SOCKET, SO_ACCEPTCONN, &listening, &listening_size) < 0 || getsockopt(socket_handle, SOL_SOCKET, SO_TYPE, &type, &type_size) < 0 || !listening || type != SOCK_STREAM) {
+                throw std::invalid_argument("Server::use_listening_sockets() given " + std::to_string(socket_handle) + ", which isn't a listening stream socket");
+            }
+        }
+        
+        for(auto socket_handle : this->adopted_sockets) {
+            close(socket_handle);
+        }
+        this->adopted_sockets = sockets;
+        
+        // Another process may be accepting from these too (around a hand-off), so a client poll() saw might be gone by the time we accept it
+        for(auto socket_handle : this->adopted_sockets) {
+            auto flags = fcntl(socket_handle, F_GETFL);
+            if(flags >= 0) {
+                fcntl(socket_handle, F_SETFL, flags | O_NONBLOCK);
+            }
+        }
+    }
+    
+    bool Server::use_inherited_listening_sockets() {
+        // Sockets start at 3, right after stdin/stdout/stderr
+        static const constexpr int FIRST_INHERITED_SOCKET = 3;
+        
+        auto *listen_pid = std::getenv("LISTEN_PID");
+        auto *listen_fds = std::getenv("LISTEN_FDS");
+        if(!listen_pid || !listen_fds || std::strtol(listen_pid, nullptr, 10) != getpid()) {
+            return false;
+        }
+        
+        auto count = std::strtol(listen_fds, nullptr, 10);
+        unsetenv("LISTEN_PID");
+        unsetenv("LISTEN_FDS");
+        unsetenv("LISTEN_FDNAMES");
+        if(count <= 0) {
+            return false;
+        }
+        
+        std::vector<int> sockets;
+        for(int socket_handle = FIRST_INHERITED_SOCKET; socket_handle < FIRST_INHERITED_SOCKET + count; socket_handle++) {
+            fcntl(socket_handle, F_SETFD, FD_CLOEXEC);
+            sockets.emplace_back(socket_handle);
+        }
+        this->use_listening_sockets(sockets);
+        return true;
+    }
+    
+    /** Fill in the address of a Unix socket */
+    static sockaddr_un unix_socket_address(const std::filesystem::path &path, const char *function) {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        auto path_string = path.string();
+        if(path_string.empty() || path_string.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument(std::string(function) + " given a path that's too long for a Unix socket");
+        }
+        std::memcpy(address.sun_path, path_string.c_str(), path_string.size() + 1);
+        return address;
+    }
+    
+    void Server::receive_listening_sockets(const std::filesystem::path &path) {
+        if(this->server_running) {
+            throw std::runtime_error("Server::receive_listening_sockets() called while accepting clients");
+        }
+        
+        auto address = unix_socket_address(path, "Server::receive_listening_sockets()");
+        Socket connection(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if(*connection.socket < 0) {
+            throw except_latest_error("failed to make socket");
+        }
+        if(connect(*connection.socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+            auto error = except_latest_error("could not connect to " + path.string());
+            connection.destroy();
+            throw error;
+        }
+        
+        std::vector<int> sockets;
+        try {
+            sockets = receive_socket_handles(*connection.socket);
+            this->use_listening_sockets(sockets);
+        }
+        catch(std::exception &) {
+            for(auto socket_handle : sockets) {
+                close(socket_handle);
+            }
+            connection.destroy();
+            throw;
+        }
+        
+        // Let the other server know it can start draining
+        char done = 0;
+        send(*connection.socket, &done, sizeof(done), MSG_NOSIGNAL);
+        connection.destroy();
+    }
+    
+    bool Server::hand_off_listening_sockets(const std::filesystem::path &path, std::chrono::milliseconds timeout) {
+        if(!this->server_running) {
+            throw std::runtime_error("Server::hand_off_listening_sockets() called while not accepting clients");
+        }
+        
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        auto wait_for = [&deadline](int socket_handle) {
+            while(true) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+                pollfd poll_handle = {};
+                poll_handle.fd = socket_handle;
+                poll_handle.events = POLLIN;
+                auto result = poll(&poll_handle, 1, static_cast<int>(std::max<decltype(remaining)>(remaining, 0)));
+                if(result >= 0 || errno != EINTR) {
+                    return result > 0;
+                }
+            }
+        };
+        
+        // Make the Unix socket for the other server to connect to, and clean it up however we leave
+        auto address = unix_socket_address(path, "Server::hand_off_listening_sockets()");
+        struct HandOff {
+            Socket listener;
+            Socket connection;
+            std::string path;
+            ~HandOff() {
+                if(this->listener.socket.has_value()) {
+                    unlink(this->path.c_str());
+                }
+                this->listener.destroy();
+                this->connection.destroy();
+            }
+        } hand_off;
+        
+        auto listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listener < 0) {
+            throw except_latest_error("failed to make socket");
+        }
+        unlink(address.sun_path);
+        if(bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+            auto error = except_latest_error("bind failed");
+            close(listener);
+            throw error;
+        }
+        hand_off.listener.socket = listener;
+        hand_off.path = address.sun_path;
+        if(listen(listener, 1) < 0) {
+            throw except_latest_error("listen failed");
+        }
+        
+        if(!wait_for(listener)) {
+            return false;
+        }
+        auto connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if(connection < 0) {
+            throw except_latest_error("accept failed");
+        }
+        hand_off.connection.socket = connection;
         
+        // Send them while holding the lock so accept_clients() can't close them in the meantime
+        {
+            std::lock_guard<std::mutex> lock(this->acceptor_shards_mutex);
+            std::vector<int> sockets;
+            for(auto &shard : this->acceptor_shards) {
+                if(shard->socket.socket.has_value()) {
+                    sockets.emplace_back(*shard->socket.socket);
+                }
+            }
+            if(sockets.empty()) {
+                return false;
+            }
+            send_socket_handles(connection, sockets);
+        }
+        
+        // Wait for the other server to say it has them
+        char done;
+        return wait_for(connection) && recv(connection, &done, sizeof(done), 0) == sizeof(done);
+    }
+    
+    std::vector<AcceptorShardStatistics> Server::get_acceptor_shard_statistics() const {
+        std::lock_guard<std::mutex> lock(this->acceptor_shards_mutex);
+        std::vector<AcceptorShardStatistics> statistics;
+        for(auto &shard : this->acceptor_shards) {
+            auto &shard_statistics = statistics.emplace_back();
+            shard_statistics.cpu = shard->cpu;
+            shard_statistics.connections_accepted = shard->connections_accepted;
+            shard_statistics.connections_active = shard->connections_active;
+        }
+        return statistics;
+    }
+    
+    int Server::open_listening_socket(bool non_blocking, bool reuse_port) {
         // Make the actual socket
-        int socket_flags = 0;
-        auto socket_handle = socket(this->address->ss.ss_family, SOCK_STREAM, socket_flags);
+        int socket_flags = SOCK_CLOEXEC;
+        if(non_blocking) {
+            socket_flags |= SOCK_NONBLOCK;
+        }
+        auto socket_handle = socket(this->address->ss.ss_family, SOCK_STREAM | socket_flags, 0);
         
         // Failed to make a socket
         if(socket_handle < 0) {
@@ -290,20 +1007,36 @@ namespace Mousygem {
         // Support both IPv6 and IPv4 if we're doing all addresses
         if(this->ipv4_and_ipv6) {
             if(setsockopt(socket_handle, IPPROTO_IPV6, IPV6_V6ONLY, &sockopt_off, sizeof(sockopt_off)) < 0) {
+                close(socket_handle);
                 throw except_latest_error("setsockopt failed (when disabling IPV6_ONLY)");
             }
         }
         
         // Allow re-binding
         if(setsockopt(socket_handle, SOL_SOCKET, SO_REUSEADDR, &sockopt_on, sizeof(sockopt_on)) < 0) {
+            close(socket_handle);
             throw except_latest_error("setsockopt failed (when enabling SO_REUSEADDR)");
         }
         
-        // We don't want to wait forever (in case we want to arbitrarily close the server)
-        struct timeval timeout;
-        timeout.tv_sec = 10;
-        timeout.tv_usec = 0;
-        setsockopt(socket_handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        // Let the other shards bind to the same address
+        if(reuse_port && setsockopt(socket_handle, SOL_SOCKET, SO_REUSEPORT, &sockopt_on, sizeof(sockopt_on)) < 0) {
+            close(socket_handle);
+            throw except_latest_error("setsockopt failed (when enabling SO_REUSEPORT)");
+        }
+        
+        // Don't bother waking up for clients that haven't sent anything yet
+        int defer_accept = static_cast<int>(this->listen_options.defer_accept.count());
+        if(defer_accept > 0 && setsockopt(socket_handle, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept)) < 0) {
+            close(socket_handle);
+            throw except_latest_error("setsockopt failed (when enabling TCP_DEFER_ACCEPT)");
+        }
+        
+        // Let returning clients send their ClientHello in the SYN
+        int fast_open = this->listen_options.fast_open_queue_length;
+        if(fast_open > 0 && setsockopt(socket_handle, IPPROTO_TCP, TCP_FASTOPEN, &fast_open, sizeof(fast_open)) < 0) {
+            close(socket_handle);
+            throw except_latest_error("setsockopt failed (when enabling TCP_FASTOPEN)");
+        }
         
         // Actually bind now
         if(bind(socket_handle, reinterpret_cast<sockaddr *>(&this->address->ss), this->address->ss_size) < 0) {
@@ -312,104 +1045,325 @@ namespace Mousygem {
         }
         
         // Hey, listen!
-        if(listen(socket_handle, 0) < 0) {
+        if(listen(socket_handle, this->listen_options.backlog) < 0) {
             close(socket_handle);
             throw except_latest_error("listen failed");
         }
         
-        // All right. We have a socket and it's bound.
-        auto socket = Socket(socket_handle);
+        return socket_handle;
+    }
+    
+    void Server::client_connected(Client *client) {
+        client->accepted_at = std::chrono::steady_clock::now();
+        this->metrics->connections_accepted.fetch_add(1, std::memory_order_relaxed);
+        client->shard->connections_accepted++;
+        client->shard->connections_active++;
         
-        // Get clients
-        while(true) {
-            // Are we shutting down?
-            if(!shutdown_mutex.try_lock()) {
-                goto destroy_socket_now_spaghetti;
-            }
-            
-            // Nope? Okay.
-            shutdown_mutex.unlock();
+        if(this->rate_limiter) {
+            client->over_connection_limit = !this->rate_limiter->connect(*client->socket_address, client->rate_limit_entry);
+        }
+        
+        std::lock_guard<std::mutex> lock(this->connected_clients_mutex);
+        this->connected_clients++;
+        client->previous_connected = nullptr;
+        client->next_connected = this->connected_client_list;
+        if(this->connected_client_list) {
+            this->connected_client_list->previous_connected = client;
+        }
+        this->connected_client_list = client;
+    }
+    
+    void Server::client_disconnected(Client *client) noexcept {
+        auto &shard = *client->shard;
+        shard.connections_active--;
+        
+        if(this->rate_limiter) {
+            this->rate_limiter->disconnect(client->rate_limit_entry);
+        }
+        
+        // Notify while holding the lock, since the server may be destroyed as soon as shutdown() sees this
+        std::lock_guard<std::mutex> lock(this->connected_clients_mutex);
+        this->connected_clients--;
+        if(client->previous_connected) {
+            client->previous_connected->next_connected = client->next_connected;
+        }
+        else {
+            this->connected_client_list = client->next_connected;
+        }
+        if(client->next_connected) {
+            client->next_connected->previous_connected = client->previous_connected;
+        }
+        
+        // Close it while shutdown() can't be disconnecting it
+        client->socket->destroy();
+        shard.clients.release(client);
+        this->connected_clients_changed.notify_all();
+    }
+    
+    void Server::accept_loop(AcceptorShard &shard, unsigned long maximum_parallel_connections) {
+        ScopedCpuPin pin(shard.cpu);
+        auto socket_handle = *shard.socket.socket;
+        
+        while(!this->shutting_down) {
+            // Wait for a client or for shutdown() to wake us up
+            pollfd poll_handles[2] = {};
+            poll_handles[0].fd = socket_handle;
+            poll_handles[0].events = POLLIN;
+            poll_handles[1].fd = this->shutdown_event;
+            poll_handles[1].events = POLLIN;
             
-            // Check maximum clients to see if we can spawn another parallel thread
-            if(maximum_parallel_connections > 0) {
-                while(true) {
-                    // Are we shutting down?
-                    if(!shutdown_mutex.try_lock()) {
-                        goto destroy_socket_now_spaghetti;
-                    }
-                    
-                    // One can never be too sure
-                    shutdown_mutex.unlock();
-                    
-                    // Check the current client count
-                    this->connected_clients_mutex.lock();
-                    auto current_count = this->connected_clients;
-                    this->connected_clients_mutex.unlock();
-                    
-                    // Wait if we're at the maximum or above
-                    if(current_count < maximum_parallel_connections) {
-                        break;
-                    }
-                    
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10)); // prevent busy waiting
-                }
+            if(poll(poll_handles, 2, -1) < 0 || poll_handles[1].revents || !(poll_handles[0].revents & POLLIN)) {
+                continue;
             }
             
             // Listen for a client
             sockaddr_storage client_address;
             socklen_t client_address_length = sizeof(sockaddr_storage);
-            auto client_handle = accept(socket_handle, reinterpret_cast<sockaddr *>(&client_address), &client_address_length);
+            auto client_handle = accept4(socket_handle, reinterpret_cast<sockaddr *>(&client_address), &client_address_length, SOCK_CLOEXEC);
             if(client_handle < 0) {
                 continue;
             }
             
-            // Make a new SSL thingy
-            auto *ssl = SSL_new(this->ssl_context->get_context());
-            this->connected_clients_mutex.lock();
-            this->connected_clients++;
-            this->connected_clients_mutex.unlock();
-            
-            auto *client = new Client;
-            client->socket = std::make_unique<Socket>(client_handle);
-            client->socket_address = std::make_unique<SocketAddress>(client_address, client_address_length);
+            auto *client = shard.clients.acquire(client_handle, client_address, client_address_length);
+            client->shard = &shard;
+            this->client_connected(client);
             
             // Serve the client
             if(maximum_parallel_connections == 0) {
-                serve_client(this, ssl, client); // parallel connections are disabled - use the main thread
+                serve_client(this, client); // parallel connections are disabled - use the main thread
+                continue;
+            }
+            
+            // Hand it to a worker (capturing little enough that the job fits in std::function without allocating). If the queue is full, this
+            // either waits for room or drops the client.
+            bool block = this->worker_backpressure == Backpressure::Block;
+            if(!this->worker_pool->submit([this, client]() { serve_client(this, client); }, block)) {
+                this->client_disconnected(client);
+            }
+        }
+    }
+    
+    void Server::accept_clients(unsigned long maximum_parallel_connections) {
+        // Can we do that?
+        if(this->server_running) {
+            throw std::runtime_error("Server::accept_clients() called while accepting clients");
+        }
+        if(this->shutting_down) {
+            throw std::runtime_error("Server::accept_clients() called while shutting down");
+        }
+        
+        bool epoll = this->connection_engine == ConnectionEngine::Epoll;
+        
+        // How many acceptors? Parallel connections being disabled means there's only one.
+        unsigned int shard_count = this->acceptor_shard_count;
+        if(shard_count == 0) {
+            shard_count = std::max(std::thread::hardware_concurrency(), 1U);
+        }
+        if(maximum_parallel_connections == 0) {
+            shard_count = 1;
+        }
+        
+        // Sockets we were given each get a shard
+        if(!this->adopted_sockets.empty()) {
+            if(maximum_parallel_connections == 0 && this->adopted_sockets.size() > 1) {
+                throw std::runtime_error("Server::accept_clients() can't serve more than one listening socket with parallel connections disabled");
+            }
+            shard_count = static_cast<unsigned int>(this->adopted_sockets.size());
+        }
+        
+        // All right. Make our sockets and bind them (unless we were given them).
+        {
+            std::vector<std::unique_ptr<AcceptorShard>> shards;
+            auto cpu_count = std::max(std::thread::hardware_concurrency(), 1U);
+            for(unsigned int i = 0; i < shard_count; i++) {
+                int cpu = this->pin_acceptors_to_cpus ? static_cast<int>(i % cpu_count) : -1;
+                int socket_handle = this->adopted_sockets.empty() ? this->open_listening_socket(epoll, shard_count > 1) : this->adopted_sockets[i];
+                shards.emplace_back(std::make_unique<AcceptorShard>(socket_handle, cpu));
+            }
+            this->adopted_sockets.clear();
+            
+            std::lock_guard<std::mutex> lock(this->acceptor_shards_mutex);
+            this->acceptor_shards = std::move(shards);
+        }
+        
+        // Writing to a client that disconnected (or that shutdown() disconnected) raises SIGPIPE, which would kill the whole process by default
+        struct sigaction sigpipe_action = {};
+        if(sigaction(SIGPIPE, nullptr, &sigpipe_action) == 0 && sigpipe_action.sa_handler == SIG_DFL) {
+            signal(SIGPIPE, SIG_IGN);
+        }
+        
+        // Clear any leftover shutdown signal before anyone can see that we're running
+        eventfd_t leftover_event;
+        eventfd_read(this->shutdown_event, &leftover_event);
+        
+        // Start
+        this->connected_clients_mutex.lock();
+        this->server_running = true;
+        this->connected_clients_mutex.unlock();
+        
+        // Hand everything off to the event loops if we're using epoll
+        if(epoll) {
+            unsigned int loop_count = this->epoll_loop_threads;
+            unsigned long loop_connection_limit = 0;
+            
+            // Parallel connections are disabled - one loop, one client at a time
+            if(maximum_parallel_connections == 0) {
+                loop_count = 1;
+                loop_connection_limit = 1;
             }
             else {
-                std::thread(serve_client, this, ssl, client).detach(); // split off to a thread
+                // Each shard gets its own loop
+                if(shard_count > 1) {
+                    loop_count = shard_count;
+                }
+                else if(loop_count == 0) {
+                    loop_count = std::max(std::thread::hardware_concurrency(), 1U);
+                }
+                loop_connection_limit = (maximum_parallel_connections + loop_count - 1) / loop_count;
+            }
+            
+            try {
+                std::vector<AcceptorShard *> shards;
+                for(auto &shard : this->acceptor_shards) {
+                    shards.emplace_back(shard.get());
+                }
+                
+                EpollEngine engine(*this, shards, loop_count, loop_connection_limit);
+                
+                this->running_engine_mutex.lock();
+                this->running_engine = &engine;
+                this->running_engine_mutex.unlock();
+                
+                // If we started shutting down before the engine was registered, stop right away
+                if(this->shutting_down) {
+                    engine.stop();
+                }
+                
+                engine.run();
+                
+                this->running_engine_mutex.lock();
+                this->running_engine = nullptr;
+                this->running_engine_mutex.unlock();
+            }
+            catch(std::exception &) {
+                this->running_engine_mutex.lock();
+                this->running_engine = nullptr;
+                this->running_engine_mutex.unlock();
+                
+                this->acceptor_shards_mutex.lock();
+                for(auto &shard : this->acceptor_shards) {
+                    shard->socket.destroy();
+                }
+                this->acceptor_shards_mutex.unlock();
+                
+                std::lock_guard<std::mutex> lock(this->connected_clients_mutex);
+                this->server_running = false;
+                this->connected_clients_changed.notify_all();
+                throw;
+            }
+            
+            goto destroy_socket_now_spaghetti;
+        }
+        
+        // Start the timer thread for deadlines (or keep the one we already have)
+        if(!this->timer_thread) {
+            this->timer_thread = std::make_unique<TimerThread>(std::chrono::milliseconds(100), 1024, [this](TimerWheel::Timer &timer) {
+                this->count_timeout(timer.kind);
+                ::shutdown(*reinterpret_cast<Client *>(timer.context)->socket->socket, SHUT_RDWR);
+            });
+        }
+        
+        // Start the workers (or keep the ones we already have)
+        if(maximum_parallel_connections > 0) {
+            std::size_t thread_count = this->worker_threads ? this->worker_threads : maximum_parallel_connections;
+            std::size_t queue_capacity = this->worker_queue_capacity ? this->worker_queue_capacity : thread_count;
+            
+            std::lock_guard<std::mutex> lock(this->worker_pool_mutex);
+            if(!this->worker_pool || this->worker_pool->get_thread_count() != thread_count || this->worker_pool->get_queue_capacity() != queue_capacity) {
+                this->worker_pool.reset();
+                this->worker_pool = std::make_unique<WorkerPool>(thread_count, queue_capacity);
+            }
+        }
+        
+        // Get clients. The first shard uses this thread, and the rest get their own.
+        {
+            std::vector<std::thread> acceptor_threads;
+            for(unsigned int i = 1; i < shard_count; i++) {
+                acceptor_threads.emplace_back(&Server::accept_loop, this, std::ref(*this->acceptor_shards[i]), maximum_parallel_connections);
+            }
+            
+            this->accept_loop(*this->acceptor_shards[0], maximum_parallel_connections);
+            
+            for(auto &thread : acceptor_threads) {
+                thread.join();
             }
         }
         
         destroy_socket_now_spaghetti:
         
-        // Done
-        socket.destroy();
+        // Done. Close the listening sockets but keep the shards around for their statistics.
+        this->acceptor_shards_mutex.lock();
+        for(auto &shard : this->acceptor_shards) {
+            shard->socket.destroy();
+        }
+        this->acceptor_shards_mutex.unlock();
+        
+        std::lock_guard<std::mutex> lock(this->connected_clients_mutex);
         this->server_running = false;
+        this->connected_clients_changed.notify_all();
     }
+    
+    bool Server::shutdown_and_wait(std::optional<std::chrono::steady_clock::duration> drain_deadline) {
+        std::unique_lock<std::mutex> lock(this->connected_clients_mutex);
+        if(!this->server_running && this->connected_clients == 0) {
+            return true;
+        }
         
-    void Server::shutdown() {
-        this->shutdown_mutex.lock();
-        bool done_shutting_down = false;
+        // Stop accepting and interrupt accept_clients() if it's waiting for a client
+        this->shutting_down = true;
+        eventfd_write(this->shutdown_event, 1);
+        lock.unlock();
+        
+        // Wake up the event loops so they stop accepting
+        this->running_engine_mutex.lock();
+        if(this->running_engine) {
+            this->running_engine->stop();
+        }
+        this->running_engine_mutex.unlock();
         
         // Wait until all clients have disconnected
-        while(!done_shutting_down) {
-            // Check if we're done yet
-            this->connected_clients_mutex.lock();
-            done_shutting_down = this->connected_clients == 0;
-            this->connected_clients_mutex.unlock();
-            
-            // Prevent busy waiting
-            if(!done_shutting_down) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto done_shutting_down = [this]() {
+            return this->connected_clients == 0 && !this->server_running;
+        };
+        
+        lock.lock();
+        bool drained = true;
+        if(drain_deadline.has_value() && !this->connected_clients_changed.wait_for(lock, *drain_deadline, done_shutting_down)) {
+            // Out of time. Anything blocked on these sockets (or waiting on them in epoll) will fail immediately.
+            drained = false;
+            for(auto *client = this->connected_client_list; client; client = client->next_connected) {
+                ::shutdown(*client->socket->socket, SHUT_RDWR);
             }
         }
+        this->connected_clients_changed.wait(lock, done_shutting_down);
         
-        this->shutdown_mutex.unlock();
+        this->shutting_down = false;
+        return drained;
     }
-        
+    
+    void Server::shutdown() {
+        this->shutdown_and_wait(std::nullopt);
+    }
+    
+    bool Server::shutdown(std::chrono::steady_clock::duration drain_deadline) {
+        return this->shutdown_and_wait(drain_deadline);
+    }
+    
     Server::~Server() {
         this->shutdown();
+        close(this->shutdown_event);
+        for(auto socket_handle : this->adopted_sockets) {
+            close(socket_handle);
+        }
     }
 }
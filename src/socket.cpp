@@ -1,5 +1,7 @@
 #include <stdexcept>
+#include <algorithm>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include "socket.hpp"
 
 namespace Mousygem {
@@ -21,4 +23,98 @@ namespace Mousygem {
         }
         return std::string(pt);
     }
+    
+    // Handles sent per message (well under the kernel's limit of 253)
+    static const constexpr std::size_t HANDLES_PER_MESSAGE = 64;
+    
+    void send_socket_handles(int unix_socket, const std::vector<int> &handles) {
+        // Each message has a byte of data (required to carry ancillary data) and up to HANDLES_PER_MESSAGE handles. The last one has none.
+        std::size_t offset = 0;
+        while(true) {
+            auto count = std::min(HANDLES_PER_MESSAGE, handles.size() - offset);
+            
+            char data = 0;
+            iovec data_vector = { &data, sizeof(data) };
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDLES_PER_MESSAGE)] = {};
+            
+            msghdr message = {};
+            message.msg_iov = &data_vector;
+            message.msg_iovlen = 1;
+            if(count > 0) {
+                message.msg_control = control;
+                message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+                auto *header = CMSG_FIRSTHDR(&message);
+                header->cmsg_level = SOL_SOCKET;
+                header->cmsg_type = SCM_RIGHTS;
+                header->cmsg_len = CMSG_LEN(sizeof(int) * count);
+                std::memcpy(CMSG_DATA(header), handles.data() + offset, sizeof(int) * count);
+            }
+            
+            ssize_t sent;
+            do {
+                sent = sendmsg(unix_socket, &message, MSG_NOSIGNAL);
+            }
+            while(sent < 0 && errno == EINTR);
+            if(sent < 0) {
+                throw except_latest_error("sendmsg failed");
+            }
+            
+            if(count == 0) {
+                return;
+            }
+            offset += count;
+        }
+    }
+    
+    std::vector<int> receive_socket_handles(int unix_socket) {
+        std::vector<int> handles;
+        while(true) {
+            char data;
+            iovec data_vector = { &data, sizeof(data) };
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * HANDLES_PER_MESSAGE)];
+            
+            msghdr message = {};
+            message.msg_iov = &data_vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            
+            ssize_t received;
+            do {
+                received = recvmsg(unix_socket, &message, MSG_CMSG_CLOEXEC);
+            }
+            while(received < 0 && errno == EINTR);
+            
+            if(received < 0) {
+                auto error = except_latest_error("recvmsg failed");
+                for(auto handle : handles) {
+                    close(handle);
+                }
+                throw error;
+            }
+            
+            // Keep whatever came with the message, even if it's bad, so it gets closed
+            std::size_t count = 0;
+            for(auto *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+                if(header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                    auto header_count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    auto first = handles.size();
+                    handles.resize(first + header_count);
+                    std::memcpy(handles.data() + first, CMSG_DATA(header), sizeof(int) * header_count);
+                    count += header_count;
+                }
+            }
+            
+            if(received == 0 || (message.msg_flags & MSG_CTRUNC)) {
+                for(auto handle : handles) {
+                    close(handle);
+                }
+                throw std::runtime_error(received == 0 ? "connection closed before all socket handles were received" : "too many socket handles received at once");
+            }
+            
+            if(count == 0) {
+                return handles;
+            }
+        }
+    }
 }
@@ -3,11 +3,22 @@
 
 #include <string>
 #include <optional>
+#include <stdexcept>
 #include <cstddef>
+#include <cstring>
+#include <vector>
+#include <errno.h>
 #include <openssl/ssl.h>
 #include <unistd.h>
+#include <netinet/in.h>
 
 namespace Mousygem {
+    // Make an exception from errno
+    static inline std::runtime_error except_latest_error(const std::string &message) {
+        auto error_number = errno;
+        return std::runtime_error(message + ": " + strerrorname_np(error_number) + " - " + strerrordesc_np(error_number));
+    }
+    
     struct Socket {
         // Socket handle
         std::optional<int> socket;
@@ -45,6 +56,12 @@ namespace Mousygem {
             *reinterpret_cast<sockaddr_in6 *>(&this->ss) = sin6;
         }
     };
+    
+    // Send file descriptors over a connected Unix socket (SCM_RIGHTS), followed by an empty batch
+    void send_socket_handles(int unix_socket, const std::vector<int> &handles);
+    
+    // Receive file descriptors sent with send_socket_handles() (close-on-exec)
+    std::vector<int> receive_socket_handles(int unix_socket);
 }
 
 #endif
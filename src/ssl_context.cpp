@@ -1,8 +1,190 @@
 #include <stdexcept>
+#include <cstring>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/opensslv.h>
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 #include "ssl_context.hpp"
 
 namespace Mousygem {
+    void SessionTicketKeys::set_rotation_interval(std::chrono::seconds rotation_interval, std::chrono::seconds ticket_lifetime) noexcept {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->rotation_interval = rotation_interval;
+        this->ticket_lifetime = ticket_lifetime;
+    }
+    
+    void SessionTicketKeys::rotate_if_needed(std::chrono::steady_clock::time_point now) {
+        // Drop keys that can't have issued an unexpired ticket
+        while(!this->keys.empty() && now - this->keys.back().created >= this->rotation_interval + this->ticket_lifetime) {
+            this->keys.pop_back();
+        }
+        
+        if(!this->keys.empty() && now - this->keys.front().created < this->rotation_interval) {
+            return;
+        }
+        
+        SessionTicketKey key;
+        if(RAND_bytes(key.name, sizeof(key.name)) != 1 || RAND_bytes(key.aes_key, sizeof(key.aes_key)) != 1 || RAND_bytes(key.hmac_key, sizeof(key.hmac_key)) != 1) {
+            throw std::runtime_error("failed to generate a session ticket key");
+        }
+        key.created = now;
+        this->keys.push_front(key);
+        this->rotations++;
+    }
+    
+    SessionTicketKey SessionTicketKeys::get_current_key() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->rotate_if_needed(std::chrono::steady_clock::now());
+        return this->keys.front();
+    }
+    
+    bool SessionTicketKeys::find_key(const unsigned char *name, SessionTicketKey &key, bool &is_current) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->rotate_if_needed(std::chrono::steady_clock::now());
+        
+        for(std::size_t i = 0; i < this->keys.size(); i++) {
+            if(std::memcmp(this->keys[i].name, name, sizeof(key.name)) == 0) {
+                key = this->keys[i];
+                is_current = i == 0;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    // Called by OpenSSL to encrypt (encrypt = 1) or decrypt (encrypt = 0) a session ticket. Returns -1 on error, 0 to reject the ticket, 1
+    // if the ticket is good, or 2 if the ticket is good but should be replaced with one using the current key.
+    #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    static int session_ticket_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, int encrypt) {
+    #else
+    static int session_ticket_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *cipher, HMAC_CTX *mac, int encrypt) {
+    #endif
+        auto *keys = reinterpret_cast<SessionTicketKeys *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+        if(keys == nullptr) {
+            return -1;
+        }
+        
+        SessionTicketKey key;
+        int result = 1;
+        
+        try {
+            if(encrypt) {
+                key = keys->get_current_key();
+                if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+                    return -1;
+                }
+                std::memcpy(key_name, key.name, sizeof(key.name));
+            }
+            else {
+                bool is_current;
+                if(!keys->find_key(key_name, key, is_current)) {
+                    return 0;
+                }
+                result = is_current ? 1 : 2;
+            }
+        }
+        catch(std::exception &) {
+            return -1;
+        }
+        
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        char digest[] = "SHA256";
+        OSSL_PARAM params[] = {
+            OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+            OSSL_PARAM_construct_end()
+        };
+        if(EVP_MAC_init(mac, key.hmac_key, sizeof(key.hmac_key), params) != 1) {
+            return -1;
+        }
+        #else
+        if(HMAC_Init_ex(mac, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), nullptr) != 1) {
+            return -1;
+        }
+        #endif
+        
+        if(encrypt) {
+            if(EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key, iv) != 1) {
+                return -1;
+            }
+        }
+        else {
+            if(EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), nullptr, key.aes_key, iv) != 1) {
+                return -1;
+            }
+        }
+        
+        return result;
+    }
+    
+    // Ticket app data (which is kept in the session and serialized into tickets) is where the fingerprint lives
+    #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    static bool get_stored_fingerprint(const SSL_SESSION *session, std::array<std::byte, 32> &fingerprint) noexcept {
+        void *data;
+        std::size_t size;
+        if(SSL_SESSION_get0_ticket_appdata(const_cast<SSL_SESSION *>(session), &data, &size) != 1 || size != fingerprint.size()) {
+            return false;
+        }
+        std::memcpy(fingerprint.data(), data, size);
+        return true;
+    }
+    #endif
+    
+    static bool hash_certificate(X509 *certificate, std::array<std::byte, 32> &fingerprint) noexcept {
+        unsigned int size = 0;
+        return X509_digest(certificate, EVP_sha256(), reinterpret_cast<unsigned char *>(fingerprint.data()), &size) == 1 && size == fingerprint.size();
+    }
+    
+    void remember_peer_certificate_fingerprint(X509_STORE_CTX *store) noexcept {
+        #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        // Only the client's own certificate, not the rest of the chain
+        if(X509_STORE_CTX_get_error_depth(store) != 0) {
+            return;
+        }
+        
+        auto *ssl = reinterpret_cast<SSL *>(X509_STORE_CTX_get_ex_data(store, SSL_get_ex_data_X509_STORE_CTX_idx()));
+        auto *session = ssl ? SSL_get_session(ssl) : nullptr;
+        auto *certificate = X509_STORE_CTX_get_current_cert(store);
+        if(!session || !certificate) {
+            return;
+        }
+        
+        // The callback can be called more than once for the same certificate
+        std::array<std::byte, 32> fingerprint;
+        if(get_stored_fingerprint(session, fingerprint) || !hash_certificate(certificate, fingerprint)) {
+            return;
+        }
+        
+        // Nobody else can see the session until the handshake is done, so this is safe
+        SSL_SESSION_set1_ticket_appdata(session, fingerprint.data(), fingerprint.size());
+        #else
+        (void)store;
+        #endif
+    }
+    
+    bool get_peer_certificate_fingerprint(SSL *ssl, std::array<std::byte, 32> &fingerprint) noexcept {
+        auto *session = SSL_get_session(ssl);
+        auto *certificate = session ? SSL_SESSION_get0_peer(session) : nullptr;
+        if(!certificate) {
+            return false;
+        }
+        
+        #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        if(get_stored_fingerprint(session, fingerprint)) {
+            return true;
+        }
+        #endif
+        
+        // Not stored (e.g. the session is shared with other connections), so hash it here
+        return hash_certificate(certificate, fingerprint);
+    }
+    
     SSLContext::SSLContext() {
         // Initialize the context
         this->context = SSL_CTX_new(SSLv23_server_method());
@@ -11,10 +193,41 @@ namespace Mousygem {
         if(this->context == nullptr) {
             throw std::runtime_error("failed to create SSL context");
         }
+        
+        // Sessions can't be resumed with peer verification on unless they have a context
+        static const unsigned char session_id_context[] = "mousygem";
+        SSL_CTX_set_session_id_context(this->context, session_id_context, sizeof(session_id_context) - 1);
+        SSL_CTX_set_session_cache_mode(this->context, SSL_SESS_CACHE_SERVER);
+        
+        // Gemini uses one connection per request, so one ticket is enough
+        #if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        SSL_CTX_set_num_tickets(this->context, 1);
+        #endif
+        
+        #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(this->context, session_ticket_callback);
+        #else
+        SSL_CTX_set_tlsext_ticket_key_cb(this->context, session_ticket_callback);
+        #endif
+        
+        this->set_session_ticket_keys(std::make_shared<SessionTicketKeys>());
+    }
+    
+    void SSLContext::set_session_ticket_keys(std::shared_ptr<SessionTicketKeys> keys) noexcept {
+        this->ticket_keys = std::move(keys);
+        SSL_CTX_set_app_data(this->context, this->ticket_keys.get());
+        
+        if(this->ticket_keys) {
+            SSL_CTX_clear_options(this->context, SSL_OP_NO_TICKET);
+        }
+        else {
+            SSL_CTX_set_options(this->context, SSL_OP_NO_TICKET);
+        }
     }
     
     SSLContext::SSLContext(SSLContext &&other) noexcept {
         this->context = other.context;
+        this->ticket_keys = std::move(other.ticket_keys);
         other.context = nullptr; // set to nullptr so the destructor knows to not free it
     }
     
@@ -2,8 +2,94 @@
 #define MOUSYGEM__SSL_CONTEXT_HPP
 
 #include <openssl/ssl.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
 
 namespace Mousygem {
+    /**
+     * Key used to encrypt and authenticate session tickets
+     */
+    struct SessionTicketKey {
+        unsigned char name[16];
+        unsigned char aes_key[32];
+        unsigned char hmac_key[32];
+        std::chrono::steady_clock::time_point created;
+    };
+    
+    /**
+     * Rotating set of session ticket keys.
+     *
+     * New tickets are always encrypted with the newest key. Older keys are kept around long enough to decrypt any ticket they issued that
+     * hasn't expired yet, and clients presenting one get a fresh ticket.
+     */
+    class SessionTicketKeys {
+    public:
+        /**
+         * Set how often to rotate keys
+         * @param rotation_interval how long a key is used to encrypt new tickets
+         * @param ticket_lifetime   how long tickets are valid for
+         */
+        void set_rotation_interval(std::chrono::seconds rotation_interval, std::chrono::seconds ticket_lifetime) noexcept;
+        
+        /**
+         * Get the key to encrypt a new ticket with, rotating keys if needed. This function is thread-safe.
+         * @return key
+         * @throws std::runtime_error if a new key could not be generated
+         */
+        SessionTicketKey get_current_key();
+        
+        /**
+         * Find the key a ticket was encrypted with. This function is thread-safe.
+         * @param name       key name from the ticket
+         * @param key        set to the key, if found
+         * @param is_current set to true if this is the key new tickets are encrypted with
+         * @return true if found, false if the key is unknown or expired
+         */
+        bool find_key(const unsigned char *name, SessionTicketKey &key, bool &is_current);
+        
+        /**
+         * Get the number of keys generated so far
+         * @return number of keys
+         */
+        std::uint64_t get_rotation_count() const noexcept {
+            return this->rotations;
+        }
+    
+    private:
+        std::mutex mutex;
+        
+        /** Keys, newest first */
+        std::deque<SessionTicketKey> keys;
+        
+        std::chrono::seconds rotation_interval = std::chrono::hours(1);
+        std::chrono::seconds ticket_lifetime = std::chrono::hours(2);
+        std::atomic<std::uint64_t> rotations = 0;
+        
+        void rotate_if_needed(std::chrono::steady_clock::time_point now);
+    };
+    
+    /**
+     * Store the SHA-256 fingerprint of the client's certificate in the session being negotiated. Call this from the verify callback. The
+     * fingerprint then goes wherever the session goes (the session cache and session tickets), so resumed sessions don't hash the
+     * certificate again.
+     * @param store certificate being verified
+     */
+    void remember_peer_certificate_fingerprint(X509_STORE_CTX *store) noexcept;
+    
+    /**
+     * Get the SHA-256 fingerprint of the client's certificate, from its session if it was stored there or by hashing the certificate
+     * @param ssl         connection (after the handshake)
+     * @param fingerprint set to the fingerprint
+     * @return false if the client didn't send a certificate
+     */
+    bool get_peer_certificate_fingerprint(SSL *ssl, std::array<std::byte, 32> &fingerprint) noexcept;
+    
     /**
      * SSL context
      */
@@ -17,12 +103,27 @@ namespace Mousygem {
             return context;
         }
         
+        /**
+         * Enable or disable session tickets
+         * @param keys keys to encrypt tickets with, or nullptr to disable tickets
+         */
+        void set_session_ticket_keys(std::shared_ptr<SessionTicketKeys> keys) noexcept;
+        
+        /**
+         * Get the session ticket keys
+         * @return keys, or nullptr if tickets are disabled
+         */
+        const std::shared_ptr<SessionTicketKeys> &get_session_ticket_keys() const noexcept {
+            return this->ticket_keys;
+        }
+        
         SSLContext();
         SSLContext(SSLContext &&) noexcept;
         ~SSLContext() noexcept;
-        
+    
     private:
         SSL_CTX *context = nullptr;
+        std::shared_ptr<SessionTicketKeys> ticket_keys;
     };
 }
 
@@ -0,0 +1,302 @@
+#include <mousygem/static_files.hpp>
+#include <mousygem/uri.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <optional>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Mousygem {
+    // Types for common extensions
+    static const std::unordered_map<std::string, std::string> default_mime_types = {
+        {"gmi", "text/gemini"},
+        {"gemini", "text/gemini"},
+        {"txt", "text/plain"},
+        {"md", "text/markdown"},
+        {"html", "text/html"},
+        {"htm", "text/html"},
+        {"css", "text/css"},
+        {"csv", "text/csv"},
+        {"xml", "application/xml"},
+        {"atom", "application/atom+xml"},
+        {"rss", "application/rss+xml"},
+        {"json", "application/json"},
+        {"js", "application/javascript"},
+        {"pdf", "application/pdf"},
+        {"zip", "application/zip"},
+        {"gz", "application/gzip"},
+        {"tar", "application/x-tar"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"webp", "image/webp"},
+        {"svg", "image/svg+xml"},
+        {"ico", "image/x-icon"},
+        {"mp3", "audio/mpeg"},
+        {"ogg", "audio/ogg"},
+        {"opus", "audio/opus"},
+        {"flac", "audio/flac"},
+        {"wav", "audio/wav"},
+        {"mp4", "video/mp4"},
+        {"webm", "video/webm"}
+    };
+    
+    static std::string lowercase(std::string string) {
+        for(auto &c : string) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return string;
+    }
+    
+    static std::int64_t modified_ns_of(const struct stat &file_stat) noexcept {
+        return static_cast<std::int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+    }
+    
+    // Percent-encode a path for a redirect
+    static std::string encode_path(const std::string &path) {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string encoded;
+        for(unsigned char c : path) {
+            if(std::isalnum(c) || std::strchr("/-._~!$&'()*+,;=:@", c)) {
+                encoded += static_cast<char>(c);
+            }
+            else {
+                encoded += '%';
+                encoded += hex[c >> 4];
+                encoded += hex[c & 0xF];
+            }
+        }
+        return encoded;
+    }
+    
+    StaticFiles::StaticFiles(const std::filesystem::path &root, std::size_t cache_size) :
+        root(std::filesystem::canonical(root)), cache_size(cache_size) {}
+    
+    void StaticFiles::set_mime_type(const std::string &extension, const std::string &mime_type) {
+        this->mime_types[lowercase(extension)] = mime_type;
+    }
+    
+    std::string StaticFiles::mime_type_for(const std::filesystem::path &path) const {
+        auto extension = path.extension().string();
+        if(!extension.empty()) {
+            extension = lowercase(extension.substr(1));
+            
+            auto custom = this->mime_types.find(extension);
+            if(custom != this->mime_types.end()) {
+                return custom->second;
+            }
+            
+            auto builtin = default_mime_types.find(extension);
+            if(builtin != default_mime_types.end()) {
+                return builtin->second;
+            }
+        }
+        return "application/octet-stream";
+    }
+    
+    Response StaticFiles::respond(const URI &uri) {
+        auto path = uri.path();
+        
+        // Sanitize the path into a relative path with no empty, ".", or ".." segments
+        if(path.find('\0') != std::string::npos) {
+            return Response(Response::BadRequest, "Invalid path");
+        }
+        
+        std::string key;
+        std::size_t segment_start = 0;
+        while(segment_start <= path.size()) {
+            auto segment_end = path.find('/', segment_start);
+            if(segment_end == std::string::npos) {
+                segment_end = path.size();
+            }
+            
+            auto segment = path.substr(segment_start, segment_end - segment_start);
+            if(segment == "..") {
+                return Response(Response::NotFound, "Not found");
+            }
+            if(!segment.empty() && segment != ".") {
+                if(!key.empty()) {
+                    key += '/';
+                }
+                key += segment;
+            }
+            
+            segment_start = segment_end + 1;
+        }
+        
+        // Keep the trailing slash so "dir" still gets redirected to "dir/" after "dir/" is cached
+        bool directory_requested = path.empty() || path.back() == '/';
+        if(directory_requested && !key.empty()) {
+            key += '/';
+        }
+        
+        // Check the cache first
+        {
+            std::unique_lock<std::mutex> lock(this->cache_mutex);
+            auto found = this->cache_index.find(key);
+            if(found != this->cache_index.end()) {
+                auto file = found->second;
+                auto now = std::chrono::steady_clock::now();
+                
+                // Check if it changed on disk if we haven't checked in a while
+                if(now - file->checked >= this->revalidate_interval) {
+                    auto file_path = file->file_path;
+                    lock.unlock();
+                    
+                    struct stat file_stat;
+                    bool stat_ok = stat(file_path.c_str(), &file_stat) == 0;
+                    
+                    lock.lock();
+                    this->statistics.revalidations++;
+                    
+                    // It may have been evicted while we weren't holding the lock
+                    found = this->cache_index.find(key);
+                    if(found != this->cache_index.end()) {
+                        file = found->second;
+                        if(stat_ok && static_cast<std::uint64_t>(file_stat.st_dev) == file->device && static_cast<std::uint64_t>(file_stat.st_ino) == file->inode && modified_ns_of(file_stat) == file->modified_ns && static_cast<std::uint64_t>(file_stat.st_size) == file->size) {
+                            file->checked = now;
+                        }
+                        else {
+                            this->erase(file);
+                            this->statistics.invalidations++;
+                            found = this->cache_index.end();
+                        }
+                    }
+                }
+                
+                if(found != this->cache_index.end()) {
+                    this->cache.splice(this->cache.begin(), this->cache, file);
+                    this->statistics.hits++;
+                    return Response(Response::Success, file->mime_type, file->data);
+                }
+            }
+            
+            this->statistics.misses++;
+        }
+        
+        // Find the file
+        auto file_path = this->root / key;
+        std::error_code ec;
+        auto status = std::filesystem::status(file_path, ec);
+        if(ec) {
+            return Response(Response::NotFound, "Not found");
+        }
+        
+        if(std::filesystem::is_directory(status)) {
+            // Make sure relative links in the index work
+            if(!directory_requested) {
+                return Response(Response::RedirectPermanent, encode_path(path + "/"));
+            }
+            
+            file_path /= this->index_file;
+            if(!std::filesystem::is_regular_file(file_path, ec)) {
+                return Response(Response::NotFound, "Not found");
+            }
+        }
+        else if(!std::filesystem::is_regular_file(status)) {
+            return Response(Response::NotFound, "Not found");
+        }
+        
+        // Don't follow symlinks out of the directory
+        auto canonical_path = std::filesystem::canonical(file_path, ec);
+        if(ec) {
+            return Response(Response::NotFound, "Not found");
+        }
+        auto relative = canonical_path.lexically_relative(this->root);
+        if(relative.empty() || *relative.begin() == "..") {
+            return Response(Response::NotFound, "Not found");
+        }
+        
+        auto mime_type = this->mime_type_for(canonical_path);
+        
+        std::optional<ResponseFile> file;
+        try {
+            file.emplace(canonical_path);
+        }
+        catch(std::exception &) {
+            return Response(Response::NotFound, "Not found");
+        }
+        
+        struct stat file_stat;
+        if(fstat(file->get_handle(), &file_stat) != 0) {
+            return Response(Response::TemporaryFailure, "Failed to read file");
+        }
+        
+        // Too big to cache? Send it from disk.
+        auto size = file->get_size();
+        if(size > this->max_cached_file_size || size > this->cache_size) {
+            return Response(Response::Success, mime_type, std::move(*file));
+        }
+        
+        // Read it all in
+        auto data = std::make_shared<std::vector<std::byte>>(static_cast<std::size_t>(size));
+        std::size_t offset = 0;
+        while(offset < data->size()) {
+            auto read_size = pread(file->get_handle(), data->data() + offset, data->size() - offset, static_cast<off_t>(offset));
+            if(read_size <= 0) {
+                return Response(Response::TemporaryFailure, "Failed to read file");
+            }
+            offset += static_cast<std::size_t>(read_size);
+        }
+        
+        CachedFile cached_file;
+        cached_file.key = key;
+        cached_file.file_path = file_path;
+        cached_file.data = data;
+        cached_file.mime_type = mime_type;
+        cached_file.device = static_cast<std::uint64_t>(file_stat.st_dev);
+        cached_file.inode = static_cast<std::uint64_t>(file_stat.st_ino);
+        cached_file.modified_ns = modified_ns_of(file_stat);
+        cached_file.size = size;
+        cached_file.checked = std::chrono::steady_clock::now();
+        
+        {
+            std::lock_guard<std::mutex> lock(this->cache_mutex);
+            this->insert(std::move(cached_file));
+        }
+        
+        return Response(Response::Success, mime_type, std::shared_ptr<const std::vector<std::byte>>(std::move(data)));
+    }
+    
+    void StaticFiles::insert(CachedFile &&file) {
+        // Another thread may have loaded it already; the newer read wins
+        auto existing = this->cache_index.find(file.key);
+        if(existing != this->cache_index.end()) {
+            this->erase(existing->second);
+        }
+        
+        // Make room
+        while(!this->cache.empty() && this->cached_bytes + file.data->size() > this->cache_size) {
+            this->erase(std::prev(this->cache.end()));
+            this->statistics.evictions++;
+        }
+        
+        this->cached_bytes += file.data->size();
+        this->cache.push_front(std::move(file));
+        this->cache_index[this->cache.front().key] = this->cache.begin();
+    }
+    
+    void StaticFiles::erase(std::list<CachedFile>::iterator file) noexcept {
+        this->cached_bytes -= file->data->size();
+        this->cache_index.erase(file->key);
+        this->cache.erase(file);
+    }
+    
+    void StaticFiles::clear_cache() noexcept {
+        std::lock_guard<std::mutex> lock(this->cache_mutex);
+        this->cache_index.clear();
+        this->cache.clear();
+        this->cached_bytes = 0;
+    }
+    
+    StaticFileStatistics StaticFiles::get_statistics() const {
+        std::lock_guard<std::mutex> lock(this->cache_mutex);
+        auto statistics = this->statistics;
+        statistics.cached_files = this->cache.size();
+        statistics.cached_bytes = this->cached_bytes;
+        return statistics;
+    }
+}
@@ -0,0 +1,76 @@
+#include "timer_wheel.hpp"
+
+namespace Mousygem {
+    TimerWheel::TimerWheel(Clock::duration tick, std::size_t slot_count) :
+        tick(tick), slot_count(slot_count), slots(std::make_unique<Timer[]>(slot_count)), start(Clock::now()) {
+        for(std::size_t i = 0; i < slot_count; i++) {
+            this->slots[i].previous = this->slots[i].next = &this->slots[i];
+        }
+    }
+    
+    void TimerWheel::schedule(Timer &timer, Clock::duration delay) noexcept {
+        this->cancel(timer);
+        
+        // Round up so it never expires early, and never put it in a tick that already passed
+        auto elapsed = Clock::now() - this->start + delay;
+        auto expires = static_cast<std::uint64_t>((elapsed + this->tick - Clock::duration(1)) / this->tick);
+        if(expires <= this->current_tick) {
+            expires = this->current_tick + 1;
+        }
+        
+        timer.expires = expires;
+        link(this->slots[expires % this->slot_count], timer);
+        this->count++;
+    }
+    
+    void TimerWheel::cancel(Timer &timer) noexcept {
+        if(timer.is_scheduled()) {
+            unlink(timer);
+            this->count--;
+        }
+    }
+    
+    TimerThread::TimerThread(TimerWheel::Clock::duration tick, std::size_t slot_count, std::function<void (TimerWheel::Timer &)> expired) :
+        wheel(tick, slot_count), expired(std::move(expired)) {
+        this->thread = std::thread(&TimerThread::run, this);
+    }
+    
+    TimerThread::~TimerThread() {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->changed.notify_all();
+        this->thread.join();
+    }
+    
+    void TimerThread::schedule(TimerWheel::Timer &timer, TimerWheel::Clock::duration delay) noexcept {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        bool was_empty = this->wheel.size() == 0;
+        this->wheel.schedule(timer, delay);
+        
+        // Wake the thread up if it's sleeping until there's something to do
+        if(was_empty) {
+            this->changed.notify_one();
+        }
+    }
+    
+    void TimerThread::cancel(TimerWheel::Timer &timer) noexcept {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->wheel.cancel(timer);
+    }
+    
+    void TimerThread::run() noexcept {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        while(!this->stopping) {
+            if(this->wheel.size() == 0) {
+                this->changed.wait(lock);
+            }
+            else {
+                auto now = TimerWheel::Clock::now();
+                this->changed.wait_until(lock, now + this->wheel.time_until_next_tick(now));
+            }
+            this->wheel.advance(TimerWheel::Clock::now(), this->expired);
+        }
+    }
+}
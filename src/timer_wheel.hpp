@@ -0,0 +1,221 @@
+#ifndef MOUSYGEM__TIMER_WHEEL_HPP
+#define MOUSYGEM__TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Mousygem {
+    /**
+     * What a connection was doing when its deadline passed
+     */
+    enum class ConnectionPhase : int {
+        Handshake,
+        Request,
+        Write
+    };
+    
+    /**
+     * Hashed timer wheel.
+     *
+     * Time is split into ticks, and each timer goes in the slot for the tick it expires on (modulo the number of slots). Scheduling and
+     * cancelling are O(1), and advancing only looks at the slots for the ticks that passed. Timers are intrusive, so nothing is allocated.
+     *
+     * This is not thread-safe.
+     */
+    class TimerWheel {
+    public:
+        using Clock = std::chrono::steady_clock;
+        
+        /**
+         * Timer that can be scheduled on a wheel. It must not be destroyed or moved while scheduled.
+         */
+        class Timer {
+            friend class TimerWheel;
+        public:
+            /** Whatever the owner needs to find what expired */
+            void *context = nullptr;
+            
+            /** Owner-defined kind of timer */
+            int kind = 0;
+            
+            /**
+             * Check if the timer is scheduled
+             * @return true if scheduled
+             */
+            bool is_scheduled() const noexcept {
+                return this->next != nullptr;
+            }
+            
+            Timer() = default;
+            Timer(const Timer &) = delete;
+            Timer &operator =(const Timer &) = delete;
+        
+        private:
+            Timer *previous = nullptr;
+            Timer *next = nullptr;
+            std::uint64_t expires = 0;
+        };
+        
+        /**
+         * Create a wheel
+         * @param tick       resolution of the wheel
+         * @param slot_count number of slots (timers further out than this many ticks wait for the wheel to come around again)
+         */
+        TimerWheel(Clock::duration tick, std::size_t slot_count);
+        
+        /**
+         * Schedule a timer, rescheduling it if it's already scheduled. It expires on the first tick at or after the delay has passed.
+         * @param timer timer to schedule
+         * @param delay how long from now until it expires
+         */
+        void schedule(Timer &timer, Clock::duration delay) noexcept;
+        
+        /**
+         * Cancel a timer if it's scheduled
+         * @param timer timer to cancel
+         */
+        void cancel(Timer &timer) noexcept;
+        
+        /**
+         * Expire every timer whose tick has passed. Each one is unscheduled before the callback is called, and the callback may schedule or
+         * cancel any timer.
+         * @param now     current time
+         * @param expired callback, called with each expired timer
+         */
+        template<typename F> void advance(Clock::time_point now, F &&expired) {
+            auto target = this->tick_of(now);
+            if(target <= this->current_tick) {
+                return;
+            }
+            
+            // Collect everything that expired first, so the callback can't pull the list out from under us
+            Timer expired_list;
+            expired_list.previous = expired_list.next = &expired_list;
+            
+            // If we fell more than a whole turn behind, each slot only needs to be looked at once
+            auto first_tick = target - this->current_tick > this->slot_count ? target - this->slot_count + 1 : this->current_tick + 1;
+            for(auto tick_number = first_tick; tick_number <= target; tick_number++) {
+                auto &head = this->slots[tick_number % this->slot_count];
+                for(auto *timer = head.next; timer != &head;) {
+                    auto *next = timer->next;
+                    if(timer->expires <= target) {
+                        unlink(*timer);
+                        link(expired_list, *timer);
+                    }
+                    timer = next;
+                }
+            }
+            this->current_tick = target;
+            
+            while(expired_list.next != &expired_list) {
+                auto &timer = *expired_list.next;
+                unlink(timer);
+                this->count--;
+                expired(timer);
+            }
+        }
+        
+        /**
+         * Get how long until the next tick, for use as a poll timeout
+         * @param now current time
+         * @return time until the next tick
+         */
+        Clock::duration time_until_next_tick(Clock::time_point now) const noexcept {
+            auto elapsed = now - this->start;
+            return this->tick - (elapsed % this->tick);
+        }
+        
+        /**
+         * Get the number of scheduled timers
+         * @return number of timers
+         */
+        std::size_t size() const noexcept {
+            return this->count;
+        }
+        
+        TimerWheel(const TimerWheel &) = delete;
+        TimerWheel &operator =(const TimerWheel &) = delete;
+    
+    private:
+        Clock::duration tick;
+        std::size_t slot_count;
+        
+        /** List heads for each slot */
+        std::unique_ptr<Timer[]> slots;
+        
+        Clock::time_point start;
+        std::uint64_t current_tick = 0;
+        std::size_t count = 0;
+        
+        std::uint64_t tick_of(Clock::time_point time) const noexcept {
+            return time <= this->start ? 0 : static_cast<std::uint64_t>((time - this->start) / this->tick);
+        }
+        
+        static void link(Timer &head, Timer &timer) noexcept {
+            timer.previous = &head;
+            timer.next = head.next;
+            head.next->previous = &timer;
+            head.next = &timer;
+        }
+        
+        static void unlink(Timer &timer) noexcept {
+            timer.previous->next = timer.next;
+            timer.next->previous = timer.previous;
+            timer.previous = timer.next = nullptr;
+        }
+    };
+    
+    /**
+     * Timer wheel driven by its own thread, for connections that block in their own threads. Expired timers are handed to a callback on the
+     * wheel's thread. The thread only ticks while timers are scheduled.
+     */
+    class TimerThread {
+    public:
+        /**
+         * Start the thread
+         * @param tick       resolution of the wheel
+         * @param slot_count number of slots
+         * @param expired    callback for expired timers (called with the wheel locked, so cancel() waits for it to return)
+         */
+        TimerThread(TimerWheel::Clock::duration tick, std::size_t slot_count, std::function<void (TimerWheel::Timer &)> expired);
+        
+        /**
+         * Stop the thread
+         */
+        ~TimerThread();
+        
+        /**
+         * Schedule a timer. This function is thread-safe.
+         * @param timer timer to schedule
+         * @param delay how long from now until it expires
+         */
+        void schedule(TimerWheel::Timer &timer, TimerWheel::Clock::duration delay) noexcept;
+        
+        /**
+         * Cancel a timer. Once this returns, the callback is not running for it and won't be. This function is thread-safe.
+         * @param timer timer to cancel
+         */
+        void cancel(TimerWheel::Timer &timer) noexcept;
+        
+        TimerThread(const TimerThread &) = delete;
+        TimerThread &operator =(const TimerThread &) = delete;
+    
+    private:
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool stopping = false;
+        TimerWheel wheel;
+        std::function<void (TimerWheel::Timer &)> expired;
+        std::thread thread;
+        
+        void run() noexcept;
+    };
+}
+
+#endif
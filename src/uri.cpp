@@ -2,13 +2,21 @@
 #include <cstring>
 #include <stdexcept>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 namespace Mousygem {
-    URI::URI(const std::string &uri_string) : data(uri_string) {
+    URI::URI(const std::string &uri_string) : URI(uri_string, std::pmr::get_default_resource()) {}
+    
+    URI::URI(std::string_view uri_string, std::pmr::memory_resource *memory) : data(uri_string, memory) {
         try {
-            this->validate();
+            this->parse();
         }
         catch(std::exception &) {
-            throw std::invalid_argument(uri_string + " is not a valid URI");
+            throw std::invalid_argument(std::string(uri_string) + " is not a valid URI");
         }
     }
     
@@ -16,166 +24,241 @@ namespace Mousygem {
         return (*this = URI(uri_string));
     }
     
-    void URI::validate() {
-        // this->hostname_offset(); // called inside port_offset() anyway
-        this->port_offset();
-    }
-    
     static constexpr const char colon_slash_slash[] = "://";
     
-    std::size_t URI::hostname_offset() const {
-        auto colon_slash_slash_offset = this->data.find(colon_slash_slash);
-        if(colon_slash_slash_offset == std::string::npos) {
-            throw std::exception();
-        }
-        return colon_slash_slash_offset + sizeof(colon_slash_slash) - 1;
-    }
-    
-    std::size_t URI::path_offset() const {
-        auto forward_slash_offset = this->data.find_first_of('/', this->hostname_offset());
-        if(forward_slash_offset == std::string::npos) {
-            return this->data.size();
-        }
-        
-        return forward_slash_offset;
-    }
-    
-    std::optional<std::size_t> URI::port_offset() const {
-        std::size_t start = this->hostname_offset(), end = this->path_offset();
+    // Find the first control character (0x00-0x1F or 0x7F), which can't appear in a URI, checking 16 bytes at a time where we can
+    static std::size_t find_control_character(const char *data, std::size_t size) noexcept {
+        std::size_t i = 0;
         
-        // Empty hostname
-        if(start == end) {
-            return std::nullopt;
+        #if defined(__SSE2__)
+        const auto max_control = _mm_set1_epi8(0x1F);
+        const auto del = _mm_set1_epi8(0x7F);
+        for(; i + 16 <= size; i += 16) {
+            auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            
+            // min(c, 0x1F) == c only if c <= 0x1F (unsigned)
+            auto control = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(chunk, max_control), chunk), _mm_cmpeq_epi8(chunk, del));
+            auto mask = _mm_movemask_epi8(control);
+            if(mask != 0) {
+                return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned int>(mask)));
+            }
         }
-        
-        // We can't just look for a colon right off the bat because IPv6 is a thing >.>
-        const auto *str = this->c_str();
-        
-        if(str[start] == '[') {
-            start = this->data.find_first_of(']', start); // find the matching ']'
-            if(start == std::string::npos) {
-                throw std::exception();
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+        const auto max_control = vdupq_n_u8(0x1F);
+        const auto del = vdupq_n_u8(0x7F);
+        for(; i + 16 <= size; i += 16) {
+            auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t *>(data + i));
+            auto control = vorrq_u8(vcleq_u8(chunk, max_control), vceqq_u8(chunk, del));
+            
+            // Found one; let the loop below find exactly where
+            if(vmaxvq_u8(control) != 0) {
+                break;
             }
         }
+        #endif
         
-        // Now we can look for a colon
-        auto colon = this->data.find_first_of(':', start);
-        if(colon == std::string::npos || colon >= end) {
-            return std::nullopt;
+        for(; i < size; i++) {
+            auto c = static_cast<unsigned char>(data[i]);
+            if(c < 0x20 || c == 0x7F) {
+                return i;
+            }
         }
         
-        // We have a port
-        auto port_start = colon + 1;
-        const char *port_start_str = str + port_start;
-        
-        // Too bad it's invalid
-        if(port_start == end) {
+        return size;
+    }
+    
+    void URI::parse() {
+        if(this->data.size() > UINT32_MAX) {
             throw std::exception();
         }
         
-        // Check the first character
-        if(*port_start_str < '0' || *port_start_str > '9') {
+        // No control characters (including null bytes) allowed
+        if(find_control_character(this->data.data(), this->data.size()) != this->data.size()) {
             throw std::exception();
         }
         
-        // Is it out of range or a valid number?
-        const char *port_end_str;
-        if(std::strtol(port_start_str, const_cast<char **>(&port_end_str), 10) > UINT16_MAX) {
+        // Find the hostname
+        auto colon_slash_slash_offset = this->data.find(colon_slash_slash);
+        if(colon_slash_slash_offset == std::string::npos) {
             throw std::exception();
         }
+        std::size_t hostname_start = colon_slash_slash_offset + sizeof(colon_slash_slash) - 1;
         
-        // Is the end of the number string expected?
-        if(port_start_str == port_end_str || port_end_str != str + end) {
-            throw std::exception();
+        // Find the path
+        auto path_start = this->data.find_first_of('/', hostname_start);
+        if(path_start == std::string::npos) {
+            path_start = this->data.size();
         }
         
-        return port_start;
-    }
-    
-    std::optional<std::size_t> URI::input_offset() const {
-        auto question_mark_offset = this->data.find_first_of('?', this->path_offset());
-        if(question_mark_offset == std::string::npos) {
-            return std::nullopt;
+        // Find the input
+        auto path_end = this->data.find_first_of('?', path_start);
+        if(path_end == std::string::npos) {
+            path_end = this->data.size();
         }
         
-        return question_mark_offset + 1;
-    }
-    
-    std::optional<std::uint16_t> URI::port() const {
-        auto port_offset = this->port_offset();
-        if(!port_offset.has_value()) {
-            return std::nullopt;
-        }
+        // Find the port, if we have a hostname
+        std::size_t hostname_end = path_start;
+        std::optional<std::uint16_t> port_number;
         
-        return std::strtoul(this->c_str() + *port_offset, nullptr, 10);
-    }
-    
-    std::string URI::protocol() const {
-        return this->data.substr(0, this->hostname_offset() - (sizeof(colon_slash_slash) - 1));
-    }
-    
-    static std::string decode_percent_encoding(std::string input) {
-        for(std::size_t i = 0; i + 2 < input.size(); i++) {
-            if(input[i] == '%') {
-                auto to_hex_upper = [](char input) -> std::optional<int> {
-                    if(input >= '0' && input <= '9') {
-                        return input - '0';
-                    }
-                    if(input >= 'a' && input <= 'f') {
-                        return input - 'a' + 10;
-                    }
-                    if(input >= 'A' && input <= 'F') {
-                        return input - 'A' + 10;
-                    }
-                    
-                    return std::nullopt;
-                };
+        if(hostname_start != path_start) {
+            // We can't just look for a colon right off the bat because IPv6 is a thing >.>
+            const auto *str = this->c_str();
+            std::size_t start = hostname_start;
+            
+            if(str[start] == '[') {
+                start = this->data.find_first_of(']', start); // find the matching ']'
+                if(start == std::string::npos) {
+                    throw std::exception();
+                }
+            }
+            
+            // Now we can look for a colon
+            auto colon = this->data.find_first_of(':', start);
+            if(colon != std::string::npos && colon < path_start) {
+                // We have a port
+                auto port_start = colon + 1;
+                const char *port_start_str = str + port_start;
                 
-                auto d1 = to_hex_upper(input[i + 1]);
-                auto d2 = to_hex_upper(input[i + 2]);
+                // Too bad it's invalid
+                if(port_start == path_start) {
+                    throw std::exception();
+                }
                 
-                // Skip if no hex character for both
-                if(!d1.has_value() || !d2.has_value()) {
-                    continue;
+                // Check the first character
+                if(*port_start_str < '0' || *port_start_str > '9') {
+                    throw std::exception();
+                }
+                
+                // Is it out of range or a valid number?
+                const char *port_end_str;
+                auto port = std::strtol(port_start_str, const_cast<char **>(&port_end_str), 10);
+                if(port > UINT16_MAX) {
+                    throw std::exception();
+                }
+                
+                // Is the end of the number string expected?
+                if(port_start_str == port_end_str || port_end_str != str + path_start) {
+                    throw std::exception();
                 }
                 
-                // Otherwise replace the % with the character and delete the two memes after it
-                input[i] = (*d1 * 0x10) | *d2;
-                input.erase(i + 1, 2);
+                hostname_end = colon;
+                port_number = static_cast<std::uint16_t>(port);
             }
         }
-        return input;
+        
+        this->hostname_start = static_cast<std::uint32_t>(hostname_start);
+        this->hostname_end = static_cast<std::uint32_t>(hostname_end);
+        this->path_start = static_cast<std::uint32_t>(path_start);
+        this->path_end = static_cast<std::uint32_t>(path_end);
+        this->port_number = port_number;
     }
     
-    std::string URI::hostname() const {
-        auto port_offset = this->port_offset();
-        auto hostname_offset = this->hostname_offset();
-        auto path_offset = this->path_offset();
+    // Value of each hex digit, or -1 if it isn't one
+    static constexpr auto hex_digit_values = []() {
+        struct {
+            signed char values[256] = {};
+        } table;
         
-        // If we have a port, go until that
-        if(port_offset.has_value()) {
-            return decode_percent_encoding(this->data.substr(hostname_offset, (*port_offset - 1) - hostname_offset));
-        }
-        else {
-            return decode_percent_encoding(this->data.substr(hostname_offset, path_offset - hostname_offset));
+        for(int c = 0; c < 256; c++) {
+            if(c >= '0' && c <= '9') {
+                table.values[c] = static_cast<signed char>(c - '0');
+            }
+            else if(c >= 'a' && c <= 'f') {
+                table.values[c] = static_cast<signed char>(c - 'a' + 10);
+            }
+            else if(c >= 'A' && c <= 'F') {
+                table.values[c] = static_cast<signed char>(c - 'A' + 10);
+            }
+            else {
+                table.values[c] = -1;
+            }
         }
-    }
+        
+        return table;
+    }();
     
-    std::optional<std::string> URI::input() const {
-        auto input_offset = this->input_offset();
-        if(!input_offset.has_value()) {
-            return std::nullopt;
+    std::size_t URI::decode_percent_encoding(std::string_view input, char *output) noexcept {
+        const char *data = input.data();
+        std::size_t size = input.size();
+        std::size_t written = 0;
+        std::size_t i = 0;
+        
+        // Each byte is looked at once, so this is linear no matter how much of the input is encoded. Since we never write more than we've
+        // read, it's fine to copy 16 bytes at a time while looking for a %, even if some of them are then overwritten.
+        while(i < size) {
+            // Skip ahead to the next %, unless we're already at one (escapes tend to come in runs)
+            #if defined(__SSE2__)
+            const auto percent = _mm_set1_epi8('%');
+            while(i + 16 <= size && data[i] != '%') {
+                auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(output + written), chunk);
+                
+                auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, percent));
+                if(mask == 0) {
+                    i += 16;
+                    written += 16;
+                    continue;
+                }
+                
+                auto skip = static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned int>(mask)));
+                i += skip;
+                written += skip;
+                break;
+            }
+            #elif defined(__ARM_NEON) && defined(__aarch64__)
+            const auto percent = vdupq_n_u8('%');
+            while(i + 16 <= size && data[i] != '%') {
+                auto chunk = vld1q_u8(reinterpret_cast<const std::uint8_t *>(data + i));
+                vst1q_u8(reinterpret_cast<std::uint8_t *>(output + written), chunk);
+                
+                // Narrow the comparison to 4 bits per byte so it fits in 64 bits
+                auto matches = vceqq_u8(chunk, percent);
+                auto mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+                if(mask == 0) {
+                    i += 16;
+                    written += 16;
+                    continue;
+                }
+                
+                auto skip = static_cast<std::size_t>(__builtin_ctzll(mask) / 4);
+                i += skip;
+                written += skip;
+                break;
+            }
+            #endif
+            
+            if(i == size) {
+                break;
+            }
+            
+            char c = data[i];
+            
+            // Replace the % and the two memes after it with the character, unless it's invalid
+            if(c == '%' && i + 2 < size) {
+                auto d1 = hex_digit_values.values[static_cast<unsigned char>(data[i + 1])];
+                auto d2 = hex_digit_values.values[static_cast<unsigned char>(data[i + 2])];
+                if(d1 >= 0 && d2 >= 0) {
+                    output[written++] = static_cast<char>((d1 * 0x10) | d2);
+                    i += 3;
+                    continue;
+                }
+            }
+            
+            output[written++] = c;
+            i++;
         }
-        return decode_percent_encoding(this->data.substr(*input_offset));
+        
+        return written;
     }
     
-    std::string URI::path() const {
-        auto path_offset = this->path_offset();
-        auto input_offset = this->input_offset();
-        if(input_offset.has_value()) {
-            return decode_percent_encoding(this->data.substr(path_offset, (*input_offset - 1) - path_offset));
+    std::string URI::decode_percent_encoding(std::string_view input) {
+        // Nothing to decode? Just copy it.
+        if(input.find('%') == std::string_view::npos) {
+            return std::string(input);
         }
         
-        return decode_percent_encoding(this->data.substr(path_offset));
+        std::string output(input.size(), '\0');
+        output.resize(decode_percent_encoding(input, output.data()));
+        return output;
     }
 }
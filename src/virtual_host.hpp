@@ -0,0 +1,26 @@
+#ifndef MOUSYGEM__VIRTUAL_HOST_HPP
+#define MOUSYGEM__VIRTUAL_HOST_HPP
+
+#include <mousygem/server.hpp>
+#include <memory>
+#include <string>
+
+#include "ssl_context.hpp"
+
+namespace Mousygem {
+    /**
+     * A hostname served by a server in addition to its default one, with its own certificate and (optionally) its own handler
+     */
+    struct VirtualHost {
+        /** Lowercase hostname */
+        std::string hostname;
+        
+        /** Context holding the hostname's certificate, switched to during the handshake when the client asks for the hostname with SNI (swapped by Server::reload_virtual_host_certificate(), so load it with std::atomic_load()) */
+        std::shared_ptr<SSLContext> ssl_context;
+        
+        /** Handler for requests to the hostname, or nullptr to use Server::respond_async() */
+        Server::VirtualHostHandler handler;
+    };
+}
+
+#endif
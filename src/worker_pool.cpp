@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "worker_pool.hpp"
+
+namespace Mousygem {
+    // Raise an atomic to at least the given value
+    template<typename T> static void atomic_max(std::atomic<T> &atomic, T value) noexcept {
+        auto current = atomic.load(std::memory_order_relaxed);
+        while(current < value && !atomic.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+    
+    WorkerPool::WorkerPool(std::size_t thread_count, std::size_t queue_capacity) : queue_capacity(std::max<std::size_t>(queue_capacity, 1)) {
+        thread_count = std::max<std::size_t>(thread_count, 1);
+        
+        // Make all of the deques before any worker can go looking in them
+        for(std::size_t i = 0; i < thread_count; i++) {
+            this->workers.emplace_back(std::make_unique<Worker>());
+        }
+        
+        for(std::size_t i = 0; i < thread_count; i++) {
+            this->workers[i]->thread = std::thread(&WorkerPool::run_worker, this, i);
+        }
+    }
+    
+    WorkerPool::~WorkerPool() {
+        this->sleep_mutex.lock();
+        this->stopping = true;
+        this->sleep_mutex.unlock();
+        this->work_available.notify_all();
+        
+        for(auto &worker : this->workers) {
+            worker->thread.join();
+        }
+    }
+    
+    bool WorkerPool::submit(Job &&job, bool block) {
+        std::unique_lock<std::mutex> lock(this->sleep_mutex);
+        
+        // Full?
+        if(this->queued >= this->queue_capacity) {
+            if(!block) {
+                this->jobs_rejected++;
+                return false;
+            }
+            this->space_available.wait(lock, [this]() { return this->queued < this->queue_capacity; });
+        }
+        
+        // Count it before it's visible so it can never be taken before it's counted
+        auto depth = ++this->queued;
+        atomic_max(this->peak_queue_depth, depth);
+        
+        auto &worker = *this->workers[this->next_worker++ % this->workers.size()];
+        worker.mutex.lock();
+        worker.jobs.push_back(QueuedJob { std::move(job), std::chrono::steady_clock::now() });
+        worker.mutex.unlock();
+        
+        lock.unlock();
+        this->work_available.notify_one();
+        return true;
+    }
+    
+    bool WorkerPool::take_job(std::size_t index, QueuedJob &job) noexcept {
+        auto worker_count = this->workers.size();
+        
+        // Check our own deque first, then steal from everyone else's
+        for(std::size_t i = 0; i < worker_count; i++) {
+            auto &worker = *this->workers[(index + i) % worker_count];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if(!worker.jobs.empty()) {
+                job = std::move(worker.jobs.front());
+                worker.jobs.pop_front();
+                this->queued--;
+                return true;
+            }
+        }
+        
+        return false;
+    }
+    
+    void WorkerPool::run_worker(std::size_t index) noexcept {
+        while(true) {
+            QueuedJob job;
+            if(this->take_job(index, job)) {
+                // Let blocked submitters know there's room (take the lock so the wakeup can't be missed)
+                this->sleep_mutex.lock();
+                this->sleep_mutex.unlock();
+                this->space_available.notify_one();
+                
+                auto wait_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - job.queued_at).count());
+                this->total_wait_ns += wait_ns;
+                atomic_max(this->max_wait_ns, wait_ns);
+                
+                job.job();
+                this->jobs_completed++;
+                continue;
+            }
+            
+            std::unique_lock<std::mutex> lock(this->sleep_mutex);
+            if(this->stopping && this->queued == 0) {
+                return;
+            }
+            
+            // Something was queued while we were looking? Go get it.
+            if(this->queued > 0) {
+                continue;
+            }
+            
+            this->work_available.wait(lock, [this]() { return this->stopping || this->queued > 0; });
+        }
+    }
+    
+    WorkerPoolStatistics WorkerPool::get_statistics() const noexcept {
+        WorkerPoolStatistics statistics;
+        statistics.threads = this->workers.size();
+        statistics.queue_capacity = this->queue_capacity;
+        statistics.queue_depth = this->queued;
+        statistics.peak_queue_depth = this->peak_queue_depth;
+        statistics.jobs_completed = this->jobs_completed;
+        statistics.jobs_rejected = this->jobs_rejected;
+        statistics.total_queue_wait_time = std::chrono::nanoseconds(this->total_wait_ns.load());
+        statistics.max_queue_wait_time = std::chrono::nanoseconds(this->max_wait_ns.load());
+        return statistics;
+    }
+}
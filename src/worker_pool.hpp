@@ -0,0 +1,110 @@
+#ifndef MOUSYGEM__WORKER_POOL_HPP
+#define MOUSYGEM__WORKER_POOL_HPP
+
+#include <mousygem/statistics.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Mousygem {
+    /**
+     * Fixed pool of worker threads fed by a bounded queue.
+     *
+     * Each worker has its own deque. Jobs are spread across the deques round-robin, and a worker that runs out of work steals from the
+     * others, so one slow job doesn't hold up the jobs queued behind it.
+     */
+    class WorkerPool {
+    public:
+        using Job = std::function<void()>;
+        
+        /**
+         * Start the workers
+         * @param thread_count   number of worker threads (at least 1)
+         * @param queue_capacity maximum number of jobs waiting to be run (at least 1)
+         */
+        WorkerPool(std::size_t thread_count, std::size_t queue_capacity);
+        
+        /**
+         * Run any remaining jobs and stop the workers
+         */
+        ~WorkerPool();
+        
+        /**
+         * Queue a job. This function is thread-safe.
+         * @param job   job to run
+         * @param block if true, wait for room in the queue if it is full; otherwise, fail immediately
+         * @return true if queued, false if the queue was full and block is false
+         */
+        bool submit(Job &&job, bool block);
+        
+        /**
+         * Get the number of worker threads
+         * @return thread count
+         */
+        std::size_t get_thread_count() const noexcept {
+            return this->workers.size();
+        }
+        
+        /**
+         * Get the queue capacity
+         * @return queue capacity
+         */
+        std::size_t get_queue_capacity() const noexcept {
+            return this->queue_capacity;
+        }
+        
+        /**
+         * Get statistics. This function is thread-safe.
+         * @return statistics
+         */
+        WorkerPoolStatistics get_statistics() const noexcept;
+        
+        WorkerPool(const WorkerPool &) = delete;
+        WorkerPool &operator =(const WorkerPool &) = delete;
+    
+    private:
+        struct QueuedJob {
+            Job job;
+            std::chrono::steady_clock::time_point queued_at;
+        };
+        
+        struct Worker {
+            std::deque<QueuedJob> jobs;
+            std::mutex mutex;
+            std::thread thread;
+        };
+        
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::size_t queue_capacity;
+        
+        /** Jobs queued but not yet started */
+        std::atomic<std::size_t> queued = 0;
+        
+        /** Next worker to queue on */
+        std::atomic<std::size_t> next_worker = 0;
+        
+        /** For sleeping workers and blocked submitters */
+        std::mutex sleep_mutex;
+        std::condition_variable work_available;
+        std::condition_variable space_available;
+        bool stopping = false;
+        
+        /** Statistics */
+        std::atomic<std::size_t> peak_queue_depth = 0;
+        std::atomic<std::uint64_t> jobs_completed = 0;
+        std::atomic<std::uint64_t> jobs_rejected = 0;
+        std::atomic<std::uint64_t> total_wait_ns = 0;
+        std::atomic<std::uint64_t> max_wait_ns = 0;
+        
+        void run_worker(std::size_t index) noexcept;
+        bool take_job(std::size_t index, QueuedJob &job) noexcept;
+    };
+}
+
+#endif
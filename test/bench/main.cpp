@@ -0,0 +1,671 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <mousygem/response.hpp>
+#include <mousygem/router.hpp>
+#include <mousygem/uri.hpp>
+#include <openssl/crypto.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "client_pool.hpp"
+#include "response_cache.hpp"
+#include "response_writer.hpp"
+
+using namespace Mousygem;
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocation counting
+////////////////////////////////////////////////////////////////////////////////
+
+// Every allocation made through operator new or by OpenSSL
+static std::atomic<std::uint64_t> allocations = 0;
+
+void *operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if(auto *memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+// std::pmr::new_delete_resource() allocates with the alignment overloads
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    auto align = std::max(static_cast<std::size_t>(alignment), sizeof(void *));
+    if(auto *memory = std::aligned_alloc(align, (std::max<std::size_t>(size, 1) + align - 1) / align * align)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void *memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+static void *openssl_malloc(std::size_t size, const char *, int) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size);
+}
+
+static void *openssl_realloc(void *memory, std::size_t size, const char *, int) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return std::realloc(memory, size);
+}
+
+static void openssl_free(void *memory, const char *, int) {
+    std::free(memory);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Running benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+// Keep the compiler from optimizing results away
+static volatile std::size_t sink;
+
+// Options
+static const char *filter = nullptr;
+static double scale = 1.0;
+static bool first_result = true;
+
+// Run a benchmark a few times and print the fastest run as a JSON object
+template<typename F> static void bench(const char *name, std::size_t iterations, F &&function) {
+    if(filter && !std::strstr(name, filter)) {
+        return;
+    }
+    
+    iterations = std::max<std::size_t>(static_cast<std::size_t>(static_cast<double>(iterations) * scale), 1);
+    
+    // Warm up caches (and anything lazily initialized)
+    for(std::size_t i = 0; i < std::max<std::size_t>(iterations / 10, 1); i++) {
+        sink = sink + function();
+    }
+    
+    double best_ns = 0.0;
+    double allocations_per_op = 0.0;
+    for(int run = 0; run < 5; run++) {
+        auto allocations_before = allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < iterations; i++) {
+            sink = sink + function();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        auto allocations_after = allocations.load(std::memory_order_relaxed);
+        
+        auto ns = static_cast<double>(elapsed.count()) / static_cast<double>(iterations);
+        if(run == 0 || ns < best_ns) {
+            best_ns = ns;
+        }
+        allocations_per_op = static_cast<double>(allocations_after - allocations_before) / static_cast<double>(iterations);
+    }
+    
+    std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, \"allocs_per_op\": %.2f}", first_result ? "" : ",", name, iterations, best_ns, allocations_per_op);
+    std::fflush(stdout);
+    first_result = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// The URI parser as it was before offsets were cached, kept here to compare against. Every accessor rescans the string and allocates.
+////////////////////////////////////////////////////////////////////////////////
+
+class LegacyURI {
+public:
+    LegacyURI(const std::string &uri_string) : data(uri_string) {
+        this->port_offset();
+    }
+    
+    std::string protocol() const {
+        return this->data.substr(0, this->hostname_offset() - 3);
+    }
+    
+    std::string hostname() const {
+        auto port_offset = this->port_offset();
+        auto hostname_offset = this->hostname_offset();
+        if(port_offset.has_value()) {
+            return decode(this->data.substr(hostname_offset, (*port_offset - 1) - hostname_offset));
+        }
+        return decode(this->data.substr(hostname_offset, this->path_offset() - hostname_offset));
+    }
+    
+    std::optional<std::uint16_t> port() const {
+        auto port_offset = this->port_offset();
+        if(!port_offset.has_value()) {
+            return std::nullopt;
+        }
+        return std::strtoul(this->data.c_str() + *port_offset, nullptr, 10);
+    }
+    
+    std::string path() const {
+        auto path_offset = this->path_offset();
+        auto input_offset = this->input_offset();
+        if(input_offset.has_value()) {
+            return decode(this->data.substr(path_offset, (*input_offset - 1) - path_offset));
+        }
+        return decode(this->data.substr(path_offset));
+    }
+    
+    std::optional<std::string> input() const {
+        auto input_offset = this->input_offset();
+        if(!input_offset.has_value()) {
+            return std::nullopt;
+        }
+        return decode(this->data.substr(*input_offset));
+    }
+
+private:
+    std::string data;
+    
+    std::size_t hostname_offset() const {
+        auto offset = this->data.find("://");
+        if(offset == std::string::npos) {
+            throw std::exception();
+        }
+        return offset + 3;
+    }
+    
+    std::size_t path_offset() const {
+        auto offset = this->data.find_first_of('/', this->hostname_offset());
+        return offset == std::string::npos ? this->data.size() : offset;
+    }
+    
+    std::optional<std::size_t> port_offset() const {
+        std::size_t start = this->hostname_offset(), end = this->path_offset();
+        if(start == end) {
+            return std::nullopt;
+        }
+        if(this->data[start] == '[') {
+            start = this->data.find_first_of(']', start);
+            if(start == std::string::npos) {
+                throw std::exception();
+            }
+        }
+        auto colon = this->data.find_first_of(':', start);
+        if(colon == std::string::npos || colon >= end) {
+            return std::nullopt;
+        }
+        const char *port_end;
+        if(std::strtol(this->data.c_str() + colon + 1, const_cast<char **>(&port_end), 10) > UINT16_MAX || port_end != this->data.c_str() + end) {
+            throw std::exception();
+        }
+        return colon + 1;
+    }
+    
+    std::optional<std::size_t> input_offset() const {
+        auto offset = this->data.find_first_of('?', this->path_offset());
+        if(offset == std::string::npos) {
+            return std::nullopt;
+        }
+        return offset + 1;
+    }
+    
+    static std::string decode(std::string input) {
+        auto to_hex = [](char input) -> std::optional<int> {
+            if(input >= '0' && input <= '9') {
+                return input - '0';
+            }
+            if(input >= 'a' && input <= 'f') {
+                return input - 'a' + 10;
+            }
+            if(input >= 'A' && input <= 'F') {
+                return input - 'A' + 10;
+            }
+            return std::nullopt;
+        };
+        
+        for(std::size_t i = 0; i + 2 < input.size(); i++) {
+            if(input[i] == '%') {
+                auto d1 = to_hex(input[i + 1]);
+                auto d2 = to_hex(input[i + 2]);
+                if(!d1.has_value() || !d2.has_value()) {
+                    continue;
+                }
+                input[i] = static_cast<char>((*d1 * 0x10) | *d2);
+                input.erase(i + 1, 2);
+            }
+        }
+        return input;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// A TLS connection with both ends in memory
+////////////////////////////////////////////////////////////////////////////////
+
+class TLSPair {
+public:
+    SSL *server = nullptr;
+    SSL *client = nullptr;
+    
+    TLSPair() {
+        // Make a throwaway key and self-signed certificate
+        auto *key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if(!key_context || EVP_PKEY_keygen_init(key_context) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(key_context, &this->key) <= 0) {
+            EVP_PKEY_CTX_free(key_context);
+            throw std::runtime_error("failed to generate a key");
+        }
+        EVP_PKEY_CTX_free(key_context);
+        
+        this->certificate = X509_new();
+        X509_set_version(this->certificate, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(this->certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(this->certificate), 0);
+        X509_gmtime_adj(X509_getm_notAfter(this->certificate), 86400);
+        X509_set_pubkey(this->certificate, this->key);
+        auto *name = X509_get_subject_name(this->certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(this->certificate, name);
+        if(X509_sign(this->certificate, this->key, EVP_sha256()) <= 0) {
+            throw std::runtime_error("failed to sign the certificate");
+        }
+        
+        this->server_context = SSL_CTX_new(TLS_server_method());
+        this->client_context = SSL_CTX_new(TLS_client_method());
+        if(SSL_CTX_use_certificate(this->server_context, this->certificate) != 1 || SSL_CTX_use_PrivateKey(this->server_context, this->key) != 1) {
+            throw std::runtime_error("failed to use the certificate");
+        }
+        
+        // Same modes as the epoll engine
+        this->server = SSL_new(this->server_context);
+        this->client = SSL_new(this->client_context);
+        SSL_set_mode(this->server, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        
+        BIO *server_bio, *client_bio;
+        BIO_new_bio_pair(&server_bio, 256 * 1024, &client_bio, 256 * 1024);
+        SSL_set_bio(this->server, server_bio, server_bio);
+        SSL_set_bio(this->client, client_bio, client_bio);
+        SSL_set_accept_state(this->server);
+        SSL_set_connect_state(this->client);
+        
+        // Take turns until both ends are done
+        bool server_done = false, client_done = false;
+        for(int i = 0; i < 100 && !(server_done && client_done); i++) {
+            client_done = client_done || SSL_do_handshake(this->client) == 1;
+            server_done = server_done || SSL_do_handshake(this->server) == 1;
+        }
+        if(!server_done || !client_done) {
+            throw std::runtime_error("handshake failed");
+        }
+    }
+    
+    ~TLSPair() {
+        SSL_free(this->server);
+        SSL_free(this->client);
+        SSL_CTX_free(this->server_context);
+        SSL_CTX_free(this->client_context);
+        X509_free(this->certificate);
+        EVP_PKEY_free(this->key);
+    }
+    
+    // Read everything the client has been sent so far
+    std::size_t drain() {
+        static char buffer[16384];
+        std::size_t total = 0;
+        int received;
+        while((received = SSL_read(this->client, buffer, sizeof(buffer))) > 0) {
+            total += static_cast<std::size_t>(received);
+        }
+        ERR_clear_error();
+        return total;
+    }
+    
+    // Send a response from the server end the same way the connection engines do, reading it on the client end as it goes
+    std::size_t send(Response &response) {
+        ResponseWriter writer(response, false);
+        ResponseWriter::Chunk chunk;
+        std::size_t received = 0;
+        
+        while(writer.next_chunk(chunk)) {
+            while(chunk.size > 0) {
+                int sent = SSL_write(this->server, chunk.data, static_cast<int>(chunk.size));
+                if(sent > 0) {
+                    chunk.consume(static_cast<std::size_t>(sent));
+                    continue;
+                }
+                if(SSL_get_error(this->server, sent) != SSL_ERROR_WANT_WRITE) {
+                    throw std::runtime_error("SSL_write failed");
+                }
+                received += this->drain();
+            }
+        }
+        
+        return received + this->drain();
+    }
+    
+    TLSPair(const TLSPair &) = delete;
+    TLSPair &operator =(const TLSPair &) = delete;
+
+private:
+    EVP_PKEY *key = nullptr;
+    X509 *certificate = nullptr;
+    SSL_CTX *server_context = nullptr;
+    SSL_CTX *client_context = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+static void bench_uri() {
+    const std::pair<const char *, std::string> requests[] = {
+        {"short", "gemini://snowymouse.com"},
+        {"port", "gemini://snowymouse.com:1965/post/9-this-site-is-now-live-on-geminispace"},
+        {"ipv6_input", "gemini://[::1]:1965/some/form?test%20value"},
+        {"long", "gemini://example.org/a/rather/long/path/to/a/document/somewhere/deep/in/the/capsule/index.gmi?with%20some%20input%20too"}
+    };
+    
+    for(auto &[label, request] : requests) {
+        auto name = [label = label](const char *benchmark) {
+            static std::string name;
+            name = std::string("uri/") + benchmark + "/" + label;
+            return name.c_str();
+        };
+        
+        // What the server and its handlers typically do per request: parse, check the protocol, and get the host, path, and input
+        bench(name("legacy_parse_accessors"), 1000000, [&request]() {
+            LegacyURI uri(request);
+            return uri.protocol().size() + uri.hostname().size() + uri.path().size() + uri.input().value_or("").size() + uri.port().value_or(0);
+        });
+        
+        bench(name("parse_accessors"), 1000000, [&request]() {
+            URI uri(request);
+            return uri.protocol().size() + uri.hostname().size() + uri.path().size() + uri.input().value_or("").size() + uri.port().value_or(0);
+        });
+        
+        bench(name("parse_raw_accessors"), 1000000, [&request]() {
+            URI uri(request);
+            return uri.raw_protocol().size() + uri.raw_hostname().size() + uri.raw_path().size() + uri.raw_input().value_or("").size() + uri.port().value_or(0);
+        });
+        
+        // Parsing into a connection's arena, as the server does
+        std::byte arena_buffer[2048];
+        std::pmr::monotonic_buffer_resource arena(arena_buffer, sizeof(arena_buffer));
+        bench(name("parse_raw_accessors_arena"), 1000000, [&request, &arena]() {
+            std::size_t size;
+            {
+                URI uri(request, &arena);
+                size = uri.raw_protocol().size() + uri.raw_hostname().size() + uri.raw_path().size() + uri.raw_input().value_or("").size() + uri.port().value_or(0);
+            }
+            arena.release();
+            return size;
+        });
+        
+        // Accessors alone on an already parsed URI
+        URI uri(request);
+        bench(name("raw_accessors"), 1000000, [&uri]() {
+            return uri.raw_hostname().size() + uri.raw_path().size() + uri.raw_input().value_or("").size();
+        });
+    }
+}
+
+static void bench_decode() {
+    std::string plain = "/a/rather/long/path/to/a/document/somewhere/deep/in/the/capsule/index.gmi";
+    std::string mixed = "/caf%C3%A9/men%C3%BC/na%C3%AFve%20r%C3%A9sum%C3%A9/%E2%9C%93";
+    
+    // Adversarial input: a path made (almost) entirely of escapes, which used to take quadratic time to decode
+    std::string escapes;
+    while(escapes.size() + 3 <= 1000) {
+        escapes += "%41";
+    }
+    std::string invalid_escapes(1000, '%');
+    
+    const std::pair<const char *, const std::string *> inputs[] = {
+        {"plain", &plain},
+        {"mixed", &mixed},
+        {"escapes", &escapes},
+        {"invalid_escapes", &invalid_escapes}
+    };
+    
+    for(auto &[label, input] : inputs) {
+        auto name = [label = label](const char *benchmark) {
+            static std::string name;
+            name = std::string("decode/") + benchmark + "/" + label;
+            return name.c_str();
+        };
+        
+        char buffer[1024];
+        bench(name("into_buffer"), 1000000, [input = input, &buffer]() {
+            return URI::decode_percent_encoding(*input, buffer);
+        });
+        
+        bench(name("to_string"), 1000000, [input = input]() {
+            return URI::decode_percent_encoding(*input).size();
+        });
+    }
+}
+
+static void bench_response() {
+    std::string body = "# Hello world\r\n\r\nThis is a short gemtext document.\r\n";
+    auto shared_body = std::make_shared<const std::vector<std::byte>>(4096);
+    
+    bench("response/construct/no_data", 1000000, []() {
+        return Response(Response::NotFound, "Not found").get_meta().size();
+    });
+    
+    bench("response/construct/string", 1000000, [&body]() {
+        return Response(Response::Success, "text/gemini", body).get_meta().size();
+    });
+    
+    bench("response/construct/shared", 1000000, [&shared_body]() {
+        return Response(Response::Success, "text/gemini", shared_body).get_meta().size();
+    });
+    
+    std::byte arena_buffer[8192];
+    std::pmr::monotonic_buffer_resource arena(arena_buffer, sizeof(arena_buffer));
+    bench("response/construct/pmr_vector", 1000000, [&body, &arena]() {
+        std::size_t size;
+        {
+            auto data = reinterpret_cast<const std::byte *>(body.data());
+            Response response(Response::Success, "text/gemini", std::pmr::vector<std::byte>(data, data + body.size(), &arena));
+            size = response.get_meta().size();
+        }
+        arena.release();
+        return size;
+    });
+    
+    // The snprintf header path
+    Response response(Response::Success, "text/gemini; charset=utf-8; lang=en");
+    char header[1025];
+    bench("response/format_header", 1000000, [&response, &header]() {
+        return ResponseWriter::format_header(response, header);
+    });
+}
+
+static void bench_response_cache() {
+    // A client as the server would have it (the socket is never used)
+    ClientPool clients(1);
+    sockaddr_storage address = {};
+    address.ss_family = AF_INET;
+    auto *client = clients.acquire(socket(AF_INET, SOCK_STREAM, 0), address, sizeof(sockaddr_in));
+    
+    ResponseCache cache(1 << 20);
+    URI cached("gemini://example.org/a/rather/long/path/to/a/cached/page.gmi?with%20some%20input");
+    URI uncached("gemini://example.org/a/rather/long/path/to/a/cached/page.gmi?with%20other%20input");
+    Response response(Response::Success, "text/gemini", std::string("# Cached\r\n"));
+    response.set_cache_ttl(std::chrono::hours(1));
+    cache.store(cached, *client, response);
+    
+    bench("response_cache/find/hit", 1000000, [&cache, &cached, client]() {
+        return cache.find(cached, *client)->get_meta().size();
+    });
+    
+    bench("response_cache/find/miss", 1000000, [&cache, &uncached, client]() {
+        return static_cast<std::size_t>(cache.find(uncached, *client).has_value());
+    });
+    
+    clients.release(client);
+}
+
+static void bench_router() {
+    Router router;
+    auto handler = [](const URI &, const Client &, const Router::Parameters &) {
+        return Response(Response::NotFound, "Not found");
+    };
+    for(int i = 0; i < 100; i++) {
+        router.add("/page" + std::to_string(i), handler);
+    }
+    router.add("/users/{id}/posts/{post}", handler);
+    router.add("/files/*", handler);
+    
+    const std::pair<const char *, const char *> paths[] = {
+        {"exact", "/page57"},
+        {"parameters", "/users/42/posts/7"},
+        {"prefix", "/files/a/b/c.gmi"},
+        {"unmatched", "/nothing/here"}
+    };
+    
+    for(auto &[label, path] : paths) {
+        auto name = std::string("router/find/") + label;
+        Router::Parameters parameters;
+        bench(name.c_str(), 1000000, [&router, path = path, &parameters]() {
+            return router.find(path, parameters) != nullptr ? parameters.size() + 1 : 0;
+        });
+    }
+}
+
+static void bench_send() {
+    TLSPair pair;
+    
+    // Sizes are chosen to show the cost per response (small) and per byte (large)
+    auto small = std::make_shared<const std::vector<std::byte>>(1024);
+    auto large = std::make_shared<const std::vector<std::byte>>(1024 * 1024);
+    
+    bench("send/header_only", 100000, [&pair]() {
+        Response response(Response::NotFound, "Not found");
+        return pair.send(response);
+    });
+    
+    bench("send/vector/1KiB", 100000, [&pair]() {
+        Response response(Response::Success, "application/octet-stream", std::vector<std::byte>(1024));
+        return pair.send(response);
+    });
+    
+    bench("send/shared/1KiB", 100000, [&pair, &small]() {
+        Response response(Response::Success, "application/octet-stream", small);
+        return pair.send(response);
+    });
+    
+    bench("send/shared/1MiB", 200, [&pair, &large]() {
+        Response response(Response::Success, "application/octet-stream", large);
+        return pair.send(response);
+    });
+    
+    bench("send/source/1MiB", 200, [&pair]() {
+        std::size_t left = 1024 * 1024;
+        Response response(Response::Success, "application/octet-stream", ResponseSource([&left](std::byte *buffer, std::size_t size) {
+            size = std::min(size, left);
+            std::memset(buffer, 0, size);
+            left -= size;
+            return size;
+        }));
+        return pair.send(response);
+    });
+    
+    // Files are read into a buffer here since kernel TLS can't be used on a memory BIO
+    char file_path[] = "/tmp/mousygem-bench-XXXXXX";
+    int file_handle = mkstemp(file_path);
+    if(file_handle < 0 || ftruncate(file_handle, 1024 * 1024) != 0) {
+        throw std::runtime_error("failed to create a temporary file");
+    }
+    close(file_handle);
+    
+    bench("send/file/1MiB", 200, [&pair, &file_path]() {
+        Response response(Response::Success, "application/octet-stream", ResponseFile(file_path));
+        return pair.send(response);
+    });
+    
+    bench("send/mapped/1MiB", 200, [&pair, &file_path]() {
+        Response response(Response::Success, "application/octet-stream", std::make_shared<const MappedFile>(file_path));
+        return pair.send(response);
+    });
+    
+    unlink(file_path);
+}
+
+int main(int argc, char **argv) {
+    // This has to happen before OpenSSL allocates anything
+    CRYPTO_set_mem_functions(openssl_malloc, openssl_realloc, openssl_free);
+    
+    for(int i = 1; i < argc; i++) {
+        if(std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if(std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = std::strtod(argv[++i], nullptr);
+        }
+        else {
+            std::fprintf(stderr, "Usage: %s [--filter substring] [--scale iteration_multiplier]\n", argv[0]);
+            std::fprintf(stderr, "Prints ns/op (fastest of 5 runs) and allocations/op (operator new and OpenSSL) for each benchmark as JSON.\n");
+            return EXIT_FAILURE;
+        }
+    }
+    
+    std::printf("{\n  \"benchmarks\": [");
+    
+    try {
+        bench_uri();
+        bench_decode();
+        bench_response();
+        bench_response_cache();
+        bench_router();
+        bench_send();
+    }
+    catch(std::exception &e) {
+        std::fprintf(stderr, "Benchmark failed: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    
+    std::printf("\n  ]\n}\n");
+}
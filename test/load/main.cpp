@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <mousygem/uri.hpp>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace Mousygem;
+using Clock = std::chrono::steady_clock;
+
+////////////////////////////////////////////////////////////////////////////////
+// Options
+////////////////////////////////////////////////////////////////////////////////
+
+struct Options {
+    std::vector<std::string> urls;
+    std::size_t concurrency = 16;
+    std::size_t requests = 1000;
+    double duration = 0.0;
+    double timeout = 10.0;
+    const char *certificate = nullptr;
+    const char *private_key = nullptr;
+    bool resume = true;
+};
+
+static void print_usage(const char *program) {
+    std::fprintf(stderr,
+        "Usage: %s [options] <url>...\n"
+        "Sends Gemini requests to a server from many connections at once, and reports latency and throughput.\n"
+        "\n"
+        "  -c, --concurrency <n>     number of connections open at once (default 16)\n"
+        "  -n, --requests <n>        total number of requests to send (default 1000)\n"
+        "  -d, --duration <seconds>  send requests for this long instead of a fixed number\n"
+        "  -u, --urls <file>         read more URLs from a file (one per line); requests cycle through every URL\n"
+        "  -t, --timeout <seconds>   give up on a request after this long without progress (default 10)\n"
+        "      --cert <file>         present a client certificate (PEM, with --key)\n"
+        "      --key <file>          private key for the client certificate (PEM)\n"
+        "      --no-resume           do a full handshake for every request instead of resuming sessions\n",
+        program);
+}
+
+// Read a number for an option, or exit if it isn't one
+static double parse_number(const char *option, const char *value) {
+    char *end;
+    double number = std::strtod(value, &end);
+    if(*value == 0 || *end != 0 || number < 0) {
+        std::fprintf(stderr, "Invalid value for %s: %s\n", option, value);
+        std::exit(EXIT_FAILURE);
+    }
+    return number;
+}
+
+static Options parse_options(int argc, char **argv) {
+    Options options;
+    
+    for(int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        auto value = [&]() -> const char * {
+            if(i + 1 >= argc) {
+                std::fprintf(stderr, "Missing value for %s\n", option.c_str());
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        
+        if(option == "-c" || option == "--concurrency") {
+            options.concurrency = static_cast<std::size_t>(parse_number(argv[i], value()));
+        }
+        else if(option == "-n" || option == "--requests") {
+            options.requests = static_cast<std::size_t>(parse_number(argv[i], value()));
+        }
+        else if(option == "-d" || option == "--duration") {
+            options.duration = parse_number(argv[i], value());
+        }
+        else if(option == "-t" || option == "--timeout") {
+            options.timeout = parse_number(argv[i], value());
+        }
+        else if(option == "-u" || option == "--urls") {
+            const char *path = value();
+            std::ifstream file(path);
+            if(!file) {
+                std::fprintf(stderr, "Can't open %s\n", path);
+                std::exit(EXIT_FAILURE);
+            }
+            std::string line;
+            while(std::getline(file, line)) {
+                while(!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+                    line.pop_back();
+                }
+                if(!line.empty() && line[0] != '#') {
+                    options.urls.push_back(line);
+                }
+            }
+        }
+        else if(option == "--cert") {
+            options.certificate = value();
+        }
+        else if(option == "--key") {
+            options.private_key = value();
+        }
+        else if(option == "--no-resume") {
+            options.resume = false;
+        }
+        else if(option.size() > 1 && option[0] == '-') {
+            print_usage(argv[0]);
+            std::exit(EXIT_FAILURE);
+        }
+        else {
+            options.urls.push_back(option);
+        }
+    }
+    
+    if(options.urls.empty() || options.concurrency == 0 || (options.certificate == nullptr) != (options.private_key == nullptr)) {
+        print_usage(argv[0]);
+        std::exit(EXIT_FAILURE);
+    }
+    
+    return options;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Targets
+////////////////////////////////////////////////////////////////////////////////
+
+// A URL to request, resolved ahead of time so lookups aren't measured
+struct Target {
+    std::string request;
+    std::string hostname;
+    sockaddr_storage address = {};
+    socklen_t address_length = 0;
+};
+
+static Target resolve(const std::string &url) {
+    URI uri(url);
+    if(uri.protocol() != "gemini") {
+        throw std::invalid_argument(url + " is not a gemini:// URL");
+    }
+    
+    Target target;
+    target.request = url + "\r\n";
+    target.hostname = uri.hostname();
+    
+    // IPv6 addresses are in brackets
+    auto host = target.hostname;
+    if(host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    auto port = std::to_string(uri.port().value_or(1965));
+    
+    addrinfo hints = {};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result;
+    int error = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if(error != 0) {
+        throw std::runtime_error("Can't resolve " + host + ": " + gai_strerror(error));
+    }
+    std::memcpy(&target.address, result->ai_addr, result->ai_addrlen);
+    target.address_length = result->ai_addrlen;
+    freeaddrinfo(result);
+    
+    return target;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurements
+////////////////////////////////////////////////////////////////////////////////
+
+// Measurements for one request
+struct Sample {
+    /** Connecting and handshaking */
+    Clock::duration handshake;
+    
+    /** Sending the request until the first byte of the response came back */
+    Clock::duration first_byte;
+    
+    /** Connecting until the whole response was received */
+    Clock::duration total;
+};
+
+// Everything one connection measured, merged at the end
+struct Results {
+    std::vector<Sample> samples;
+    std::map<int, std::size_t> status_codes;
+    std::size_t bytes = 0;
+    std::size_t resumed = 0;
+    std::size_t failed = 0;
+    std::string first_error;
+    
+    void merge(const Results &other) {
+        this->samples.insert(this->samples.end(), other.samples.begin(), other.samples.end());
+        for(auto &[code, count] : other.status_codes) {
+            this->status_codes[code] += count;
+        }
+        this->bytes += other.bytes;
+        this->resumed += other.resumed;
+        this->failed += other.failed;
+        if(this->first_error.empty()) {
+            this->first_error = other.first_error;
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Sending requests
+////////////////////////////////////////////////////////////////////////////////
+
+class Connection {
+public:
+    Connection(SSL_CTX *context, const std::vector<Target> &targets, const Options &options) :
+        context(context), targets(targets), options(options), sessions(targets.size(), nullptr) {}
+    
+    ~Connection() {
+        for(auto *session : this->sessions) {
+            SSL_SESSION_free(session);
+        }
+    }
+    
+    /**
+     * Send one request and receive the whole response
+     * @param index index of the target to request
+     */
+    void request(std::size_t index) {
+        auto &target = this->targets[index];
+        auto start = Clock::now();
+        
+        int handle = socket(target.address.ss_family, SOCK_STREAM, 0);
+        if(handle < 0) {
+            this->fail("socket() failed");
+            return;
+        }
+        
+        // Don't wait forever on a stuck server
+        timeval timeout;
+        timeout.tv_sec = static_cast<time_t>(this->options.timeout);
+        timeout.tv_usec = static_cast<suseconds_t>((this->options.timeout - static_cast<double>(timeout.tv_sec)) * 1000000);
+        setsockopt(handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(handle, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        int one = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        
+        if(connect(handle, reinterpret_cast<const sockaddr *>(&target.address), target.address_length) != 0) {
+            close(handle);
+            this->fail(std::string("connect() failed: ") + std::strerror(errno));
+            return;
+        }
+        
+        auto *ssl = SSL_new(this->context);
+        SSL_set_fd(ssl, handle);
+        if(target.hostname.front() != '[') {
+            SSL_set_tlsext_host_name(ssl, target.hostname.c_str());
+        }
+        if(this->options.resume && this->sessions[index]) {
+            SSL_set_session(ssl, this->sessions[index]);
+        }
+        
+        this->exchange(ssl, target, index, start);
+        
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        close(handle);
+        ERR_clear_error();
+    }
+    
+    Results results;
+
+private:
+    SSL_CTX *context;
+    const std::vector<Target> &targets;
+    const Options &options;
+    
+    /** Last session for each target, to resume next time */
+    std::vector<SSL_SESSION *> sessions;
+    
+    void fail(const std::string &error) {
+        this->results.failed++;
+        if(this->results.first_error.empty()) {
+            this->results.first_error = error;
+        }
+    }
+    
+    void exchange(SSL *ssl, const Target &target, std::size_t index, Clock::time_point start) {
+        if(SSL_connect(ssl) != 1) {
+            this->fail("handshake failed: " + last_ssl_error());
+            return;
+        }
+        auto handshake_done = Clock::now();
+        
+        if(SSL_write(ssl, target.request.data(), static_cast<int>(target.request.size())) <= 0) {
+            this->fail("failed to send the request: " + last_ssl_error());
+            return;
+        }
+        
+        // Read until the server closes the connection, keeping enough of the start to get the status code
+        char buffer[16384];
+        char status[2] = {};
+        std::size_t received = 0;
+        Clock::time_point first_byte;
+        while(true) {
+            errno = 0;
+            int result = SSL_read(ssl, buffer, sizeof(buffer));
+            if(result <= 0) {
+                auto error = SSL_get_error(ssl, result);
+                if(error == SSL_ERROR_ZERO_RETURN || (error == SSL_ERROR_SYSCALL && ERR_peek_error() == 0 && errno == 0)) {
+                    break;
+                }
+                this->fail("failed to receive the response: " + last_ssl_error());
+                return;
+            }
+            
+            if(received == 0) {
+                first_byte = Clock::now();
+            }
+            for(std::size_t i = received; i < 2 && i - received < static_cast<std::size_t>(result); i++) {
+                status[i] = buffer[i - received];
+            }
+            received += static_cast<std::size_t>(result);
+        }
+        auto end = Clock::now();
+        
+        if(received < 2 || status[0] < '1' || status[0] > '6' || status[1] < '0' || status[1] > '9') {
+            this->fail("invalid response header");
+            return;
+        }
+        
+        this->results.samples.push_back(Sample { handshake_done - start, first_byte - handshake_done, end - start });
+        this->results.status_codes[(status[0] - '0') * 10 + (status[1] - '0')]++;
+        this->results.bytes += received;
+        if(SSL_session_reused(ssl)) {
+            this->results.resumed++;
+        }
+        
+        // With TLS 1.3, tickets arrive after the handshake, so the session is only worth keeping now
+        if(this->options.resume) {
+            auto *session = SSL_get1_session(ssl);
+            if(session && SSL_SESSION_is_resumable(session)) {
+                SSL_SESSION_free(this->sessions[index]);
+                this->sessions[index] = session;
+            }
+            else {
+                SSL_SESSION_free(session);
+            }
+        }
+    }
+    
+    static std::string last_ssl_error() {
+        auto error = ERR_get_error();
+        if(error == 0) {
+            return errno != 0 ? std::strerror(errno) : "connection closed";
+        }
+        char message[256];
+        ERR_error_string_n(error, message, sizeof(message));
+        return message;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Reporting
+////////////////////////////////////////////////////////////////////////////////
+
+static double to_ms(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Print the distribution of one measurement (sorts the samples by it)
+static void print_distribution(const char *name, std::vector<Sample> &samples, Clock::duration Sample::*field) {
+    std::sort(samples.begin(), samples.end(), [field](const Sample &a, const Sample &b) { return a.*field < b.*field; });
+    
+    auto percentile = [&samples, field](double p) {
+        auto rank = static_cast<std::size_t>(p * static_cast<double>(samples.size()) + 0.999999);
+        return to_ms(samples[std::clamp<std::size_t>(rank, 1, samples.size()) - 1].*field);
+    };
+    
+    Clock::duration sum {};
+    for(auto &sample : samples) {
+        sum += sample.*field;
+    }
+    
+    std::printf("%-12s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", name, to_ms(samples.front().*field), to_ms(sum / samples.size()),
+                percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), to_ms(samples.back().*field));
+}
+
+static void print_results(Results &results, Clock::duration elapsed, const Options &options) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    auto completed = results.samples.size();
+    
+    std::printf("Requests:    %zu completed, %zu failed in %.3f s (%zu connections, session resumption %s)\n", completed, results.failed, seconds,
+                options.concurrency, options.resume ? "on" : "off");
+    if(!results.first_error.empty()) {
+        std::printf("First error: %s\n", results.first_error.c_str());
+    }
+    if(completed == 0) {
+        return;
+    }
+    
+    std::printf("Throughput:  %.1f requests/s, %.2f MiB/s\n", static_cast<double>(completed) / seconds,
+                static_cast<double>(results.bytes) / seconds / (1024.0 * 1024.0));
+    std::printf("Resumed:     %zu of %zu handshakes\n", results.resumed, completed);
+    std::printf("Responses:  ");
+    for(auto &[code, count] : results.status_codes) {
+        std::printf(" %02d: %zu", code, count);
+    }
+    std::printf("\n\n");
+    
+    std::printf("%-12s %9s %9s %9s %9s %9s %9s %9s\n", "(ms)", "min", "mean", "p50", "p90", "p99", "p99.9", "max");
+    print_distribution("Handshake", results.samples, &Sample::handshake);
+    print_distribution("First byte", results.samples, &Sample::first_byte);
+    print_distribution("Total", results.samples, &Sample::total);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+    auto options = parse_options(argc, argv);
+    
+    std::vector<Target> targets;
+    try {
+        for(auto &url : options.urls) {
+            targets.push_back(resolve(url));
+        }
+    }
+    catch(std::exception &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    
+    // Gemini servers usually have self-signed certificates, and we're here to measure them, not check them
+    auto *context = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_verify(context, SSL_VERIFY_NONE, nullptr);
+    #ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    SSL_CTX_set_options(context, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    #endif
+    if(!options.resume) {
+        SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+    }
+    if(options.certificate) {
+        if(SSL_CTX_use_certificate_chain_file(context, options.certificate) != 1 || SSL_CTX_use_PrivateKey_file(context, options.private_key, SSL_FILETYPE_PEM) != 1) {
+            std::fprintf(stderr, "Can't use the client certificate %s with the key %s\n", options.certificate, options.private_key);
+            return EXIT_FAILURE;
+        }
+    }
+    
+    // Each connection takes the next request until the count runs out (or time is up)
+    std::atomic<std::size_t> next_request = 0;
+    auto start = Clock::now();
+    auto stop_at = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+    
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::vector<std::thread> threads;
+    for(std::size_t i = 0; i < options.concurrency; i++) {
+        connections.push_back(std::make_unique<Connection>(context, targets, options));
+        threads.emplace_back([&, connection = connections.back().get()]() {
+            while(true) {
+                auto request = next_request.fetch_add(1, std::memory_order_relaxed);
+                if(options.duration > 0.0 ? Clock::now() >= stop_at : request >= options.requests) {
+                    break;
+                }
+                connection->request(request % targets.size());
+            }
+        });
+    }
+    
+    for(auto &thread : threads) {
+        thread.join();
+    }
+    auto elapsed = Clock::now() - start;
+    
+    Results results;
+    for(auto &connection : connections) {
+        results.merge(connection->results);
+    }
+    connections.clear();
+    SSL_CTX_free(context);
+    
+    print_results(results, elapsed, options);
+    return results.samples.empty() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <mousygem/client.hpp>
+#include <mousygem/response.hpp>
+#include <mousygem/uri.hpp>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "client_pool.hpp"
+#include "response_cache.hpp"
+
+using namespace Mousygem;
+
+#define test_true(a, what) { \
+    if(!(a)) { \
+        std::cerr << __FILE__ ":" << __LINE__ << " - failed test: " << what << "\n"; \
+        std::exit(EXIT_FAILURE); \
+    } \
+}
+
+static void store(ResponseCache &cache, const Client &client, const std::string &uri, const std::string &body, Response::CacheKey key) {
+    Response response(Response::Success, "text/plain", body);
+    response.set_cache_ttl(std::chrono::hours(1), key);
+    cache.store(URI(uri), client, response);
+}
+
+static bool is_cached(ResponseCache &cache, const Client &client, const std::string &uri) {
+    return cache.find(URI(uri), client).has_value();
+}
+
+int main() {
+    // A client as the server would have it (the socket is never used)
+    ClientPool clients(1);
+    sockaddr_storage address = {};
+    address.ss_family = AF_INET;
+    auto *client = clients.acquire(socket(AF_INET, SOCK_STREAM, 0), address, sizeof(sockaddr_in));
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Key policies
+    ////////////////////////////////////////////////////////////////////////////
+    
+    {
+        ResponseCache cache(1 << 20);
+        
+        // Input matters with PathAndInput
+        store(cache, *client, "gemini://example.org/search?a", "a", Response::CacheKey::PathAndInput);
+        test_true(is_cached(cache, *client, "gemini://example.org/search?a"), "response wasn't cached");
+        test_true(!is_cached(cache, *client, "gemini://example.org/search?b"), "response was found for a different input");
+        
+        // A different policy for the same path stops the path from being cached rather than being looked up with the wrong key
+        store(cache, *client, "gemini://example.org/search?b", "b", Response::CacheKey::Path);
+        test_true(!is_cached(cache, *client, "gemini://example.org/search?a"), "path was still cached after its policy changed");
+        test_true(!is_cached(cache, *client, "gemini://example.org/search?c"), "response with a conflicting policy was found for a different input");
+        store(cache, *client, "gemini://example.org/search?a", "a", Response::CacheKey::PathAndInput);
+        test_true(!is_cached(cache, *client, "gemini://example.org/search?a"), "path was cached again before its conflicting responses expired");
+        
+        // Other paths are unaffected
+        store(cache, *client, "gemini://example.org/about", "about", Response::CacheKey::Path);
+        test_true(is_cached(cache, *client, "gemini://example.org/about?anything"), "response with the Path policy wasn't found");
+    }
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Eviction
+    ////////////////////////////////////////////////////////////////////////////
+    
+    {
+        // Entries for one path all go in the same shard, which gets 1/16th of the cache
+        const std::string body(1000, 'x');
+        ResponseCache cache(16 * 3500);
+        
+        store(cache, *client, "gemini://example.org/page?1", body, Response::CacheKey::PathAndInput);
+        store(cache, *client, "gemini://example.org/page?2", body, Response::CacheKey::PathAndInput);
+        store(cache, *client, "gemini://example.org/page?3", body, Response::CacheKey::PathAndInput);
+        
+        // Use the first one, so the second is now the least recently used
+        test_true(is_cached(cache, *client, "gemini://example.org/page?1"), "first response wasn't cached");
+        
+        store(cache, *client, "gemini://example.org/page?4", body, Response::CacheKey::PathAndInput);
+        test_true(is_cached(cache, *client, "gemini://example.org/page?1"), "recently used response was evicted");
+        test_true(!is_cached(cache, *client, "gemini://example.org/page?2"), "least recently used response wasn't evicted");
+        test_true(is_cached(cache, *client, "gemini://example.org/page?3"), "response was evicted out of order");
+        test_true(is_cached(cache, *client, "gemini://example.org/page?4"), "new response wasn't cached");
+        test_true(cache.get_statistics().evictions == 1, "expected exactly one eviction");
+    }
+    
+    clients.release(client);
+}
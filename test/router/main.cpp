@@ -0,0 +1,141 @@
+#include <iostream>
+#include <mousygem/router.hpp>
+#include <mousygem/uri.hpp>
+
+using namespace std;
+using namespace Mousygem;
+
+#define test_str(a,b) { \
+    if(a != b) { \
+        std::cerr << __FILE__ ":" << __LINE__ << " - failed test: expected " << b << ", got " << a << "\n"; \
+        std::exit(EXIT_FAILURE); \
+    } \
+}
+
+#define test_if_exceptions(...) try { \
+    __VA_ARGS__; \
+    std::cerr << __FILE__ ":" << __LINE__ << " - expected exception error\n"; \
+    std::exit(EXIT_FAILURE); \
+} \
+catch(std::exception &) {} \
+
+// Handler that says which route it is, so we can tell which one was found without calling it
+struct Route {
+    int id;
+    
+    Response operator()(const URI &, const Client &, const Router::Parameters &) const {
+        return Response(Response::Success, "text/plain", std::to_string(this->id));
+    }
+};
+
+// Find the route for a path, returning its id (or -1 if none was found)
+static int find(const Router &router, std::string_view path, Router::Parameters &parameters) {
+    auto *handler = router.find(path, parameters);
+    return handler ? handler->target<Route>()->id : -1;
+}
+
+int main() {
+    Router router;
+    router.add("/", Route{1});
+    router.add("/about", Route{2});
+    router.add("/users/{id}", Route{3});
+    router.add("/users/{id}/posts/{post}", Route{4});
+    router.add("/users/me", Route{5});
+    router.add("/files/*", Route{6});
+    router.add("/files/special", Route{7});
+    router.add("/about/", Route{8});
+    router.add("/{section}/index.gmi", Route{9});
+    
+    Router::Parameters parameters;
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Exact routes
+    ////////////////////////////////////////////////////////////////////////////
+    
+    test_str(find(router, "/", parameters), 1);
+    test_str(find(router, "", parameters), 1);
+    test_str(find(router, "/about", parameters), 2);
+    test_str(find(router, "/about/", parameters), 8);
+    test_str(find(router, "/about/more", parameters), -1);
+    test_str(find(router, "/abou", parameters), -1);
+    test_str(find(router, "/nothing", parameters), -1);
+    test_str(parameters.size(), 0);
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Parameters
+    ////////////////////////////////////////////////////////////////////////////
+    
+    test_str(find(router, "/users/42", parameters), 3);
+    test_str(parameters.size(), 1);
+    test_str(parameters[0], "42");
+    test_str(parameters.get("id").value_or("(none)"), "42");
+    test_str(parameters.get("post").value_or("(none)"), "(none)");
+    
+    test_str(find(router, "/users/42/posts/7", parameters), 4);
+    test_str(parameters.size(), 2);
+    test_str(parameters.get("id").value_or("(none)"), "42");
+    test_str(parameters.get("post").value_or("(none)"), "7");
+    
+    // Parameters aren't decoded, and don't match empty segments
+    test_str(find(router, "/users/a%20b", parameters), 3);
+    test_str(parameters.get("id").value_or("(none)"), "a%20b");
+    test_str(find(router, "/users/", parameters), -1);
+    
+    // Exact segments win over parameters
+    test_str(find(router, "/users/me", parameters), 5);
+    test_str(parameters.size(), 0);
+    
+    // ...unless only the parameter leads anywhere
+    test_str(find(router, "/about/index.gmi", parameters), 9);
+    test_str(parameters.get("section").value_or("(none)"), "about");
+    test_str(find(router, "/users/me/posts/1", parameters), 4);
+    test_str(parameters.get("id").value_or("(none)"), "me");
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Prefixes
+    ////////////////////////////////////////////////////////////////////////////
+    
+    test_str(find(router, "/files/a/b/c.gmi", parameters), 6);
+    test_str(parameters.get_rest(), "a/b/c.gmi");
+    test_str(find(router, "/files/", parameters), 6);
+    test_str(parameters.get_rest(), "");
+    test_str(find(router, "/files/special", parameters), 7);
+    test_str(parameters.get_rest(), "");
+    test_str(find(router, "/files/special/more", parameters), 6);
+    test_str(parameters.get_rest(), "special/more");
+    test_str(find(router, "/files", parameters), -1);
+    
+    // A catch-all only gets what nothing else matches
+    Router catch_all;
+    catch_all.add("/*", Route{1});
+    catch_all.add("/a/{b}", Route{2});
+    test_str(find(catch_all, "/", parameters), 1);
+    test_str(find(catch_all, "/a/b", parameters), 2);
+    test_str(find(catch_all, "/a/b/c", parameters), 1);
+    test_str(parameters.size(), 0);
+    test_str(parameters.get_rest(), "a/b/c");
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Invalid routes
+    ////////////////////////////////////////////////////////////////////////////
+    
+    test_if_exceptions(router.add("about", Route{0}));
+    test_if_exceptions(router.add("/about", Route{0}));
+    test_if_exceptions(router.add("/users/{name}", Route{0}));
+    test_if_exceptions(router.add("/files/*", Route{0}));
+    test_if_exceptions(router.add("/*/files", Route{0}));
+    test_if_exceptions(router.add("/a{b}", Route{0}));
+    test_if_exceptions(router.add("/{}", Route{0}));
+    test_if_exceptions(router.add("/{a}/{a}/c", Route{0}));
+    test_if_exceptions(router.add("/{a}/{b}/{c}/{d}/{e}/{f}/{g}/{h}/{i}", Route{0}));
+    
+    ////////////////////////////////////////////////////////////////////////////
+    // Statistics
+    ////////////////////////////////////////////////////////////////////////////
+    
+    auto statistics = router.get_statistics();
+    test_str(statistics.routes.size(), 9);
+    test_str(statistics.routes[3].pattern, "/users/{id}/posts/{post}");
+    test_str(statistics.routes[3].hits, 0);
+    test_str(statistics.unmatched, 0);
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <mousygem/mousygem.hpp>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Mousygem;
+
+#define test_true(a, what) { \
+    if(!(a)) { \
+        std::cerr << __FILE__ ":" << __LINE__ << " - failed test: " << what << "\n"; \
+        std::exit(EXIT_FAILURE); \
+    } \
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// A server with a few misbehaving handlers
+////////////////////////////////////////////////////////////////////////////////
+
+class TestServer : public Server {
+public:
+    TestServer(std::uint16_t port) : Server("127.0.0.1", port) {}
+    
+    Response respond(const URI &uri, const Client &) override {
+        auto path = uri.raw_path();
+        
+        // Slower than the request deadline, which shouldn't matter once the request has been read
+        if(path == "/slow") {
+            std::this_thread::sleep_for(std::chrono::milliseconds(800));
+            return Response(Response::Success, "text/plain", "slow");
+        }
+        
+        // Fails partway through the body
+        if(path == "/throw") {
+            auto left = std::make_shared<std::size_t>(50000);
+            return Response(Response::Success, "application/octet-stream", ResponseSource([left](std::byte *buffer, std::size_t size) -> std::size_t {
+                if(*left == 0) {
+                    throw std::runtime_error("source failed");
+                }
+                size = std::min(size, *left);
+                std::memset(buffer, 'a', size);
+                *left -= size;
+                return size;
+            }));
+        }
+        
+        return Response(Response::NotFound, "Not found");
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Helpers
+////////////////////////////////////////////////////////////////////////////////
+
+/** Make a throwaway key and self-signed certificate, returning their paths */
+static std::pair<std::string, std::string> make_certificate() {
+    char directory[] = "/tmp/mousygem-test-XXXXXX";
+    if(!mkdtemp(directory)) {
+        throw std::runtime_error("failed to make a temporary directory");
+    }
+    std::string certificate_path = std::string(directory) + "/cert.pem";
+    std::string key_path = std::string(directory) + "/key.pem";
+    
+    EVP_PKEY *key = nullptr;
+    auto *key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    if(!key_context || EVP_PKEY_keygen_init(key_context) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(key_context, &key) <= 0) {
+        throw std::runtime_error("failed to generate a key");
+    }
+    EVP_PKEY_CTX_free(key_context);
+    
+    auto *certificate = X509_new();
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+    X509_gmtime_adj(X509_getm_notAfter(certificate), 86400);
+    X509_set_pubkey(certificate, key);
+    auto *name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    if(X509_sign(certificate, key, EVP_sha256()) <= 0) {
+        throw std::runtime_error("failed to sign the certificate");
+    }
+    
+    auto *certificate_file = std::fopen(certificate_path.c_str(), "w");
+    auto *key_file = std::fopen(key_path.c_str(), "w");
+    if(!certificate_file || !key_file || PEM_write_X509(certificate_file, certificate) != 1 || PEM_write_PrivateKey(key_file, key, nullptr, nullptr, 0, nullptr, nullptr) != 1) {
+        throw std::runtime_error("failed to write the certificate");
+    }
+    std::fclose(certificate_file);
+    std::fclose(key_file);
+    X509_free(certificate);
+    EVP_PKEY_free(key);
+    
+    return {certificate_path, key_path};
+}
+
+/** What a client got back */
+struct Reply {
+    /** Everything received, header included */
+    std::string data;
+    
+    /** Whether the server closed with close_notify (rather than just dropping the connection) */
+    bool clean_close = false;
+};
+
+/** Send a request and read until the server closes the connection, retrying the connection while the server starts */
+static Reply request(std::uint16_t port, const std::string &path) {
+    int handle = -1;
+    for(int attempt = 0; attempt < 100; attempt++) {
+        handle = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(connect(handle, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0) {
+            break;
+        }
+        close(handle);
+        handle = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if(handle < 0) {
+        throw std::runtime_error("failed to connect");
+    }
+    
+    auto *context = SSL_CTX_new(TLS_client_method());
+    auto *ssl = SSL_new(context);
+    SSL_set_fd(ssl, handle);
+    if(SSL_connect(ssl) != 1) {
+        throw std::runtime_error("failed to connect with TLS");
+    }
+    
+    std::string line = "gemini://localhost" + path + "\r\n";
+    SSL_write(ssl, line.data(), static_cast<int>(line.size()));
+    
+    Reply reply;
+    char buffer[4096];
+    while(true) {
+        auto received = SSL_read(ssl, buffer, sizeof(buffer));
+        if(received <= 0) {
+            reply.clean_close = SSL_get_error(ssl, received) == SSL_ERROR_ZERO_RETURN;
+            break;
+        }
+        reply.data.append(buffer, static_cast<std::size_t>(received));
+    }
+    
+    ERR_clear_error();
+    SSL_free(ssl);
+    SSL_CTX_free(context);
+    close(handle);
+    return reply;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tests
+////////////////////////////////////////////////////////////////////////////////
+
+static void test_engine(Server::ConnectionEngine engine, std::uint16_t port, const std::pair<std::string, std::string> &certificate) {
+    TestServer server(port);
+    server.use_certificate_file(certificate.first.c_str());
+    server.use_private_key_file(certificate.second.c_str());
+    server.set_connection_engine(engine, 1);
+    
+    Server::Timeouts timeouts;
+    timeouts.request = std::chrono::milliseconds(300);
+    server.set_timeouts(timeouts);
+    
+    std::thread thread([&server]() { server.accept_clients(4); });
+    
+    // A handler slower than the request deadline still gets its response out
+    auto slow = request(port, "/slow");
+    test_true(slow.data == "20 text/plain\r\nslow", "slow handler response was cut off (got \"" << slow.data << "\")");
+    test_true(slow.clean_close, "slow handler response didn't end with close_notify");
+    test_true(server.get_timeout_statistics().request_timeouts == 0, "slow handler counted as a request timeout");
+    
+    // A source that throws cuts the response off without close_notify, so it can't pass for a complete one
+    auto cut_off = request(port, "/throw");
+    test_true(cut_off.data.rfind("20 application/octet-stream\r\n", 0) == 0, "throwing source response didn't start with its header");
+    test_true(cut_off.data.size() > 30000, "throwing source response was missing data before the throw (got " << cut_off.data.size() << " bytes)");
+    test_true(!cut_off.clean_close, "throwing source response ended with close_notify");
+    
+    server.shutdown();
+    thread.join();
+}
+
+int main() {
+    auto certificate = make_certificate();
+    
+    test_engine(Server::ConnectionEngine::Threaded, 19611, certificate);
+    test_engine(Server::ConnectionEngine::Epoll, 19612, certificate);
+    
+    std::remove(certificate.first.c_str());
+    std::remove(certificate.second.c_str());
+    rmdir(certificate.first.substr(0, certificate.first.rfind('/')).c_str());
+}
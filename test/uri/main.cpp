@@ -137,6 +137,47 @@ int main() {
     test_if_exceptions(URI("gemini://snowymouse.com:notarealport")); // port contains non-numeric characters
     test_if_exceptions(URI("gemini://snowymouse.com:1234notarealport")); // port contains non-numeric characters
     
+    ////////////////////////////////////////////////////////////////////////////
+    // Raw components and decoding
+    ////////////////////////////////////////////////////////////////////////////
+    
+    // Raw accessors don't decode anything
+    test_str(uri_with_port_and_input.raw_protocol(), "gemini");
+    test_str(uri_with_port_and_input.raw_hostname(), "snowymouse.com");
+    test_str(uri_with_port_and_input.raw_path(), "/some/form");
+    test_if_opt_is_value(uri_with_port_and_input.raw_input(), "test%20value");
+    test_str(*uri_with_port_and_input.raw_input(), "test%20value");
+    test_str(*uri_with_port_and_input.input(), "test value");
+    test_str(uri_with_null.raw_path(), "/%00hey");
+    test_str(uri_ipv6_with_port.raw_hostname(), "[::1]");
+    test_if_opt_is_nullopt(uri_simple.raw_input());
+    
+    // Empty input is still input
+    auto uri_empty_input = URI("gemini://snowymouse.com/search?");
+    test_str(uri_empty_input.raw_path(), "/search");
+    test_if_opt_is_value(uri_empty_input.raw_input(), "");
+    
+    // Decoding into a buffer; invalid and truncated sequences are left alone
+    char decoded[32];
+    std::string_view encoded = "a%41%4g%%2 %7e%2";
+    test_str(std::string_view(decoded, URI::decode_percent_encoding(encoded, decoded)), "aA%4g%%2 ~%2");
+    test_str(URI::decode_percent_encoding("%2F%2f"), "//");
+    
+    // Control characters aren't allowed anywhere, whether in the first 16 bytes or after
+    test_if_exceptions(URI("gemini://snowymouse.com/\r\n"));
+    test_if_exceptions(URI("gemini://snowymouse.com/a/long/path/to/something\x7f"));
+    test_if_exceptions(URI("gemini://snowymouse.com/a/long/path/to/something?\x01"));
+    test_if_exceptions(URI("gemini://\0snowymouse.com"s));
+    
+    // Heavily encoded input decodes in one pass
+    std::string heavily_encoded, heavily_decoded;
+    for(int i = 0; i < 341; i++) {
+        heavily_encoded += "%41";
+        heavily_decoded += "A";
+    }
+    test_str(URI("gemini://snowymouse.com/" + heavily_encoded).path(), "/" + heavily_decoded);
+    test_str(URI::decode_percent_encoding(heavily_encoded + "%4"), heavily_decoded + "%4");
+    
     ////////////////////////////////////////////////////////////////////////////
     // Other functions
     ////////////////////////////////////////////////////////////////////////////